@@ -0,0 +1,242 @@
+#! /usr/bin/perl -w
+
+# bench.pl
+#    This program benchmarks the test programs against each io61
+#    backend (your io61, stdio, slow, and fault) over a grid of file sizes,
+#    block sizes (`-b`), and strides (`-t`). Each configuration runs
+#    several trials, with the page cache cold (input decached before
+#    every trial) and/or warm (after one untimed run). It prints a
+#    throughput table with 95% confidence intervals.
+#
+#    Usage: perl bench.pl [-n TRIALS] [-c | -w] [-s SIZES] [-b BLOCKS]
+#                         [-t STRIDES] [-B BACKENDS] [-T TIMELIMIT]
+#                         [-F FAULTS] [PROGRAM...]
+#    SIZES, BLOCKS, STRIDES, and BACKENDS are comma-separated lists;
+#    sizes may use `k` and `m` suffixes. For example,
+#        perl bench.pl -w -s 20m -b 512,4096 blockcat61 stridecat61
+#
+#    The fault backend is your io61 under injected short transfers,
+#    EINTR, and EAGAIN, so comparing it with io61 measures the cost of
+#    recovering from them. FAULTS sets its schedule (IO61_FAULTS; see
+#    faultinject61.cc). For example,
+#        perl bench.pl -w -B io61,fault -F short=50,eintr=20 blockcat61
+
+use Time::HiRes qw(gettimeofday);
+use POSIX;
+use Getopt::Std;
+eval { require "syscall.ph" };
+
+# Programs to benchmark: name, whether it takes `-b`, whether it
+# takes `-t`, and extra arguments. scattergather61 and pipeexchange61
+# do not copy one input file to one output file, so they are omitted.
+my(@programs) = (
+    ["cat61", 0, 0, ""],
+    ["blockcat61", 1, 0, ""],
+    ["randblockcat61", 1, 0, "-r 6582"],
+    ["reverse61", 0, 0, ""],
+    ["reordercat61", 1, 0, "-r 6582"],
+    ["stridecat61", 1, 1, ""],
+    ["ostridecat61", 1, 1, ""],
+    ["updatecat61", 1, 0, ""],
+    ["threadcat61", 1, 0, ""]
+);
+my(%backend_prefix) = ("io61" => "", "stdio" => "stdio-", "slow" => "slow-",
+                      "fault" => "fault-");
+
+# t-distribution critical values for 95% confidence, by degrees of freedom
+my(@tcrit) = (0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+              2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+              2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+              2.060, 2.056, 2.052, 2.048, 2.045, 2.042);
+
+sub usage () {
+    print STDERR "Usage: perl bench.pl [-n TRIALS] [-c | -w] [-s SIZES] [-b BLOCKS]\n",
+        "                     [-t STRIDES] [-B BACKENDS] [-T TIMELIMIT]\n",
+        "                     [-F FAULTS] [PROGRAM...]\n";
+    exit(1);
+}
+
+sub parse_size ($) {
+    my($s) = @_;
+    $s =~ /\A(\d+)([kKmMgG]?)\z/ or usage();
+    my($n) = $1;
+    $n <<= 10 if lc($2) eq "k";
+    $n <<= 20 if lc($2) eq "m";
+    $n <<= 30 if lc($2) eq "g";
+    return $n;
+}
+
+sub size_name ($) {
+    my($n) = @_;
+    return ($n >> 20) . "M" if $n >= (1 << 20) && $n % (1 << 20) == 0;
+    return ($n >> 10) . "K" if $n >= (1 << 10) && $n % (1 << 10) == 0;
+    return $n;
+}
+
+my(%opt);
+getopts("n:cws:b:t:B:T:F:", \%opt) or usage();
+my($TRIALS) = exists($opt{"n"}) ? int($opt{"n"}) : 5;
+usage() if $TRIALS < 1 || ($opt{"c"} && $opt{"w"});
+my(@modes) = $opt{"c"} ? ("cold") : ($opt{"w"} ? ("warm") : ("cold", "warm"));
+my(@sizes) = map { parse_size($_) } split(/,/, $opt{"s"} // "1m,20m");
+my(@blocks) = map { parse_size($_) } split(/,/, $opt{"b"} // "512,4096,65536");
+my(@strides) = map { parse_size($_) } split(/,/, $opt{"t"} // "1024,16384");
+my(@backends) = split(/,/, $opt{"B"} // "io61,stdio,slow");
+my($TIMELIMIT) = exists($opt{"T"}) ? $opt{"T"} + 0 : 10;
+foreach my $b (@backends) {
+    usage() if !exists($backend_prefix{$b});
+}
+$ENV{"IO61_FAULTS"} = $opt{"F"} if exists($opt{"F"});
+if (@ARGV) {
+    my(%want) = map { $_ => 1 } @ARGV;
+    @programs = grep { $want{$_->[0]} } @programs;
+    usage() if !@programs;
+}
+if (grep { $_ eq "cold" } @modes) {
+    if (!defined(&{"SYS_fadvise64"})) {
+        print STDERR "bench.pl: cannot decache files on this system; using warm mode only\n";
+        @modes = ("warm");
+    }
+}
+
+sub decache ($) {
+    my($fn) = @_;
+    if (defined(&{"SYS_fadvise64"}) && open(DECACHE, "<", $fn)) {
+        syscall &SYS_fadvise64, fileno(DECACHE), 0, -s DECACHE, 4;
+        close(DECACHE);
+    }
+}
+
+sub makefile ($) {
+    my($size) = @_;
+    my($filename) = "files/bench-" . size_name($size) . ".txt";
+    if (!-r $filename || -s $filename != $size) {
+        truncate($filename, 0);
+        while (!defined(-s $filename) || -s $filename < $size) {
+            system("cat /usr/share/dict/words >> $filename") == 0
+                or die "bench.pl: cannot create $filename\n";
+        }
+        truncate($filename, $size);
+    }
+    return $filename;
+}
+
+# run_trial(command)
+#    Run `command` once and return its elapsed time in seconds, as
+#    reported by io61_profile_end on file descriptor 100, or undef if
+#    it failed or ran longer than the time limit.
+sub run_trial ($) {
+    my($command) = @_;
+    open(my $report, "+>", undef) or die;
+    my($pid) = fork();
+    die "bench.pl: fork: $!\n" if !defined($pid);
+    if ($pid == 0) {
+        POSIX::dup2(fileno($report), 100);
+        open(STDOUT, ">", "/dev/null");
+        open(STDERR, ">", "/dev/null");
+        setpgid(0, 0);
+        exec("/bin/sh", "-c", $command) or exit(127);
+    }
+
+    my($before) = Time::HiRes::time();
+    while (waitpid($pid, WNOHANG) == 0) {
+        if (Time::HiRes::time() - $before > $TIMELIMIT) {
+            kill 9, -$pid;
+            waitpid($pid, 0);
+            return undef;
+        }
+        Time::HiRes::usleep(2000);
+    }
+    return undef if $? != 0;
+
+    seek($report, 0, 0);
+    my($line) = <$report> // "";
+    return $line =~ /"time"\s*:\s*([\d.]+)/ ? $1 + 0 : undef;
+}
+
+# measure(command, infile, outfile, mode)
+#    Return [mean, halfwidth] of throughput in MB/s over $TRIALS trials,
+#    or undef if any trial failed.
+sub measure ($$$$) {
+    my($command, $infile, $outfile, $mode) = @_;
+    my($size) = -s $infile;
+    my(@tput);
+    if ($mode eq "warm") {
+        unlink($outfile);
+        run_trial($command) // return undef;
+    }
+    for (my $i = 0; $i != $TRIALS; ++$i) {
+        unlink($outfile);
+        decache($infile) if $mode eq "cold";
+        my($t) = run_trial($command) // return undef;
+        push @tput, $size / ($t > 0 ? $t : 1e-6) / (1 << 20);
+    }
+    my($mean) = 0;
+    $mean += $_ foreach @tput;
+    $mean /= @tput;
+    my($var) = 0;
+    $var += ($_ - $mean) ** 2 foreach @tput;
+    my($df) = @tput - 1;
+    return [$mean, 0] if $df == 0;
+    my($tc) = $df < @tcrit ? $tcrit[$df] : 1.96;
+    return [$mean, $tc * sqrt($var / $df / @tput)];
+}
+
+if (!-d "files" && (-e "files" || !mkdir("files"))) {
+    print STDERR "*** Cannot run benchmarks because 'files' cannot be created.\n";
+    exit(1);
+}
+my(@binaries);
+foreach my $p (@programs) {
+    push @binaries, map { $backend_prefix{$_} . $p->[0] } @backends;
+}
+system("make", "-s", @binaries) == 0 or exit(1);
+$| = 1;
+
+foreach my $mode (@modes) {
+    print "\n" if $mode ne $modes[0];
+    printf("MODE:      %s page cache, %d trial%s, MB/s with 95%% confidence intervals\n",
+           $mode, $TRIALS, $TRIALS == 1 ? "" : "s");
+    printf("%-15s %6s %6s %6s", "PROGRAM", "SIZE", "-b", "-t");
+    printf(" %20s", $_) foreach @backends;
+    print "   RATIO" if grep { $_ eq "stdio" } @backends;
+    print "\n";
+
+    foreach my $p (@programs) {
+        my($name, $takes_b, $takes_t, $extra) = @$p;
+        my(%slow);      # configurations that hit the time limit
+        foreach my $size (@sizes) {
+            my($infile) = makefile($size);
+            foreach my $b ($takes_b ? @blocks : (undef)) {
+                foreach my $t ($takes_t ? @strides : (undef)) {
+                    printf("%-15s %6s %6s %6s", $name, size_name($size),
+                           defined($b) ? size_name($b) : "-",
+                           defined($t) ? size_name($t) : "-");
+                    my(%result);
+                    foreach my $backend (@backends) {
+                        my($key) = join(" ", $backend, $b // "-", $t // "-");
+                        my($args) = $extra;
+                        $args .= " -b $b" if defined($b);
+                        $args .= " -t $t" if defined($t);
+                        my($command) = "./$backend_prefix{$backend}$name $args -o files/bench-out.txt $infile";
+                        my($r) = $slow{$key} ? undef
+                            : measure($command, $infile, "files/bench-out.txt", $mode);
+                        if ($r) {
+                            $result{$backend} = $r;
+                            printf(" %9.1f +- %8.1f", $r->[0], $r->[1]);
+                        } else {
+                            # Larger sizes would also fail; skip them
+                            $slow{$key} = 1;
+                            printf(" %20s", "-");
+                        }
+                    }
+                    if ($result{"io61"} && $result{"stdio"}) {
+                        printf("   %.2fx", $result{"io61"}->[0] / $result{"stdio"}->[0]);
+                    }
+                    print "\n";
+                }
+            }
+        }
+    }
+}
+unlink("files/bench-out.txt");
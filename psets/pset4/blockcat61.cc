@@ -1,29 +1,43 @@
 #include "io61.hh"
 
-// Usage: ./blockcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+// Usage: ./blockcat61 [-b BLOCKSIZE] [-l] [-D] [-z] [-Z] [-o OUTFILE] [FILE]
 //    Copies the input FILE to standard output in blocks.
-//    Default BLOCKSIZE is 4096.
+//    Default BLOCKSIZE is 4096. With `-l`, copies one line at a time
+//    using `io61_readline` instead. With `-D`, opens files with
+//    O_DIRECT to bypass the page cache. With `-z`, compresses OUTFILE;
+//    with `-Z`, decompresses FILE.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args(argc, argv, "b:o:i:");
+    io61_arguments args(argc, argv, "b:lDzZo:i:");
     size_t block_size = args.block_size ? args.block_size : 4096;
+    int direct = args.direct ? O_DIRECT : 0;
+    int zin = args.decompress ? IO61_COMPRESSED : 0;
+    int zout = args.compress ? IO61_COMPRESSED : 0;
 
     // Allocate buffer, open files
     char* buf = new char[block_size];
 
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file,
+                                     O_RDONLY | direct | zin);
     io61_file* outf = io61_open_check(args.output_file,
-                                      O_WRONLY | O_CREAT | O_TRUNC);
+                                      O_WRONLY | O_CREAT | O_TRUNC | direct
+                                      | zout);
 
     // Copy file data
     while (1) {
-        ssize_t amount = io61_read(inf, buf, block_size);
+        const char* data = buf;
+        ssize_t amount;
+        if (args.lines) {
+            amount = io61_readline(inf, &data);
+        } else {
+            amount = io61_read(inf, buf, block_size);
+        }
         if (amount <= 0) {
             break;
         }
-        io61_write(outf, buf, amount);
+        io61_write(outf, data, amount);
     }
 
     io61_close(inf);
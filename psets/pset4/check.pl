@@ -51,6 +51,7 @@ while ($sig_name[$SIGINT] ne "INT") {
 my($VERBOSE) = boolenv("VERBOSE");
 my($NOMAKE) = boolenv("NOMAKE");
 my($STRACE) = boolenv("STRACE");
+my($IOSTATS) = boolenv("IOSTATS");
 $NOSTDIO = 1 if $STRACE;
 eval { require "syscall.ph" };
 
@@ -386,7 +387,7 @@ sub enqueue ($$$%) {
 
     # prepare stdio command
     my($stdiocmd) = $command;
-    $stdiocmd =~ s<(\./)([-a-z]*61)><${1}stdio-$2>g;
+    $stdiocmd =~ s<(\./)(?:fault-)?([-a-z]*61)><${1}stdio-$2>g;
     $stdiocmd =~ s<out(\d*)\.(txt|bin)><baseout$1\.$2>g;
     my($stdio_qitem) = {
         "test_number" => $number, "desc" => $desc, "type" => "stdio",
@@ -649,16 +650,30 @@ sub run ($) {
             printf("%.5fs (%.5fs user, %.5fs system, %dKiB memory, %d trial%s)\n",
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"},
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
+            printf("IOSTATS:   %d reads, %d writes, %d lseeks, %d refills, %d cached bytes, %d flushes (%d bytes)\n",
+                   $tt->{"reads"}, $tt->{"writes"}, $tt->{"lseeks"},
+                   $tt->{"refills"}, $tt->{"cached_bytes"},
+                   $tt->{"flushes"}, $tt->{"flush_bytes"})
+                if $IOSTATS && exists($tt->{"reads"});
             push @runtimes, $tt->{"time"};
         }
 
+        # some tests report timing problems with their exit status
+        if ($tt && !exists($tt->{"killed"})
+            && $qitem->{"opt"}->{"check_status"}
+            && grep { exists($_->{"status"}) && $_->{"status"} != 0 }
+                    find_tests($number, "yourcode", $qitem->{"command"})) {
+            $tt->{"bad_status"} = 1;
+        }
+
         # print stdio vs. yourcode comparison
         if ($stdiot
             && $tt
             && $tt->{"time"}
             && !exists($tt->{"killed"})
             && !exists($tt->{"different_size"})
-            && !exists($tt->{"different_content"})) {
+            && !exists($tt->{"different_content"})
+            && !exists($tt->{"bad_status"})) {
             my($ratio) = $stdiot->{"time"} / $tt->{"time"};
             my($color) = ($ratio < 0.5 ? $Redctx : ($ratio > 1.9 ? $Green : $Cyan));
             printf("RATIO:     ${color}%.2fx stdio${Off}\n", $ratio);
@@ -675,6 +690,11 @@ sub run ($) {
                 "${Redctx}", $tt->{"different_content"}, "$Off\n";
         }
         ++$nerror if exists($tt->{"different_content"}) || exists($tt->{"different_size"});
+        if (exists($tt->{"bad_status"})) {
+            print "    ${Red}ERROR: ", $qitem->{"maincommand"},
+                " exited with nonzero status${Off}\n";
+        }
+        ++$nerror if exists($tt->{"bad_status"});
 
         # print yourcode stderr and a blank-line separator
         print $tt->{"stderr"} if exists($tt->{"stderr"}) && $tt->{"stderr"} ne "";
@@ -831,7 +851,7 @@ enqueue(12,
 
 enqueue(13,
     "./scattergather61 -b 128 -l -o files/out1.txt -o files/out2.txt -o files/out3.txt -o files/out4.txt -i files/text1meg.txt -i files/text90k-rev.txt -i files/text1meg.txt",
-    "scatter/gather 4/3 files by lines, character I/O, sequential");
+    "scatter/gather 4/3 files by lines, line I/O, sequential");
 
 
 # REGULAR FILES, REVERSE I/O
@@ -922,6 +942,103 @@ enqueue(31,
     "redirected large file, 1B-4KB block I/O, sequential");
 
 
+# LINE I/O
+
+enqueue(32,
+    "./blockcat61 -l -o files/out.txt files/text20meg.txt",
+    "regular large file, line I/O, sequential");
+
+enqueue(33,
+    "cat files/text5meg.txt | ./blockcat61 -l | cat > files/out.txt",
+    "piped medium file, line I/O, sequential");
+
+
+# READ/WRITE FILES
+
+enqueue(34,
+    "./updatecat61 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 4KB block read/write I/O, reverse update");
+
+enqueue(35,
+    "./updatecat61 -b 509 -o files/out.txt files/text1meg.txt",
+    "regular small file, 509B block read/write I/O, reverse update");
+
+
+# POSITIONAL I/O FROM MULTIPLE THREADS
+
+enqueue(36,
+    "./threadcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block positional I/O, 4 threads");
+
+enqueue(37,
+    "./threadcat61 -b 509 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 509B block positional I/O, 4 threads");
+
+# DIRECT I/O
+enqueue(38,
+    "./blockcat61 -D -b 65536 -o files/out.txt files/text20meg.txt",
+    "regular large file, 64KB block I/O, O_DIRECT");
+
+enqueue(39,
+    "./blockcat61 -D -b 509 -o files/out.txt files/text90k-rev.txt",
+    "regular small file, 509B block I/O, O_DIRECT with unaligned tail");
+
+# INTERACTIVE WRITES (checks when lines arrive, not just what arrives)
+enqueue(40,
+    "./ticker61 -o files/out.txt",
+    "piped line bursts with idle gaps, arrival within 25ms",
+    "insize" => 4096, "check_status" => 1);
+
+# COMPRESSED FILES
+enqueue(41,
+    "./blockcat61 -z files/text20meg.txt | ./blockcat61 -Z -o files/out.txt",
+    "compressed round trip through pipe, 4KB block I/O");
+
+enqueue(42,
+    "./blockcat61 -z -o files/zdata.z files/text5meg.txt && ./reverse61 -Z -o files/out.txt files/zdata.z",
+    "compressed medium file, character I/O, reverse order with index");
+
+# PARALLEL COPY ENGINE
+enqueue(43,
+    "./reordercat61 -j 4 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB blocks in random order, copy engine, 4 threads");
+
+enqueue(44,
+    "./reordercat61 -j 2 -b 1024 -r 6582 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 1KB blocks in random order, copy engine, 2 threads");
+
+# MEMORY-MAPPED INPUT
+enqueue(45,
+    "./stridecat61 -b 1024 -t 65536 -o files/out.txt files/text20meg.txt",
+    "mapped large file, 1KB block I/O, 64KB stride");
+
+enqueue(46,
+    "(dd bs=1000 count=1 of=/dev/null status=none; ./cat61 -o files/out.txt) < files/text5meg.txt",
+    "redirected medium file, read from offset 1000, not mapped");
+
+# FAULT INJECTION (see faultinject61.cc)
+enqueue(47,
+    "cat files/text5meg.txt | ./fault-blockcat61 -b 509 | cat > files/out.txt",
+    "piped medium file, 509B block I/O, injected short I/O and EINTR/EAGAIN");
+
+enqueue(48,
+    "./fault-updatecat61 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 4KB block read/write I/O, injected faults");
+
+enqueue(49,
+    "./fault-blockcat61 -z files/text5meg.txt | ./fault-blockcat61 -Z -o files/out.txt",
+    "compressed round trip through pipe, injected faults");
+
+enqueue(50,
+    "./fault-blockcat61 -D -b 509 -o files/out.txt files/text90k-rev.txt",
+    "regular small file, 509B block I/O, O_DIRECT, injected faults");
+
+# MIXED SEQUENTIAL AND POSITIONAL I/O
+enqueue(51,
+    "./updatecat61 -p -b 509 -o files/out.txt files/text1meg.txt",
+    "regular small file, 509B block read/write I/O, alternating with positional I/O");
+
+
 run($sequentially);
 
 summary();
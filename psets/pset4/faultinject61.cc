@@ -0,0 +1,176 @@
+// This file defines `read` and friends, so it cannot use the C
+// library's inline checking versions of them
+#undef _FORTIFY_SOURCE
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <atomic>
+
+// faultinject61.cc
+//    Fault-injection backend. The `fault-*` programs link this file
+//    ahead of io61.o, so it replaces `read`, `write`, `pread`, and
+//    `pwrite` with versions that misbehave the way pipes, sockets, and
+//    signal-heavy programs do. On a seeded pseudorandom schedule, a call
+//    fails with EINTR or EAGAIN before transferring anything, transfers
+//    fewer bytes than requested, or sleeps first. A correct io61 gives
+//    the same output under any schedule.
+//
+//    The schedule is set by the IO61_FAULTS environment variable, a
+//    comma-separated list of `KEY=VALUE` settings:
+//        seed=N      pseudorandom seed (default 61)
+//        eintr=P     percent of calls that fail with EINTR (default 10)
+//        eagain=P    percent of calls that fail with EAGAIN (default 5)
+//        short=P     percent of transfers cut short (default 30)
+//        delay=P     percent of calls that sleep first (default 0)
+//        usec=N      length of each sleep in microseconds (default 50)
+//    For example, `IO61_FAULTS=seed=2,delay=5 ./fault-cat61 ...`.
+//    Descriptors 2 and 100 (error messages and the profile report) are
+//    never faulted.
+
+
+struct faultinject_schedule {
+    unsigned long long seed = 61;
+    unsigned eintr = 10;
+    unsigned eagain = 5;
+    unsigned shortx = 30;
+    unsigned delay = 0;
+    unsigned usec = 50;
+    bool loaded = false;
+};
+
+static faultinject_schedule schedule;
+static std::atomic<unsigned long long> ncalls{0};
+
+
+// faultinject_load()
+//    Parse IO61_FAULTS into `schedule`. Runs before `main`.
+
+__attribute__((constructor))
+static void faultinject_load() {
+    const char* env = getenv("IO61_FAULTS");
+    while (env && *env) {
+        const char* eq = strchr(env, '=');
+        if (!eq) {
+            break;
+        }
+        size_t klen = eq - env;
+        char* end;
+        unsigned long long v = strtoull(eq + 1, &end, 0);
+        if (klen == 4 && memcmp(env, "seed", 4) == 0) {
+            schedule.seed = v;
+        } else if (klen == 5 && memcmp(env, "eintr", 5) == 0) {
+            schedule.eintr = v;
+        } else if (klen == 6 && memcmp(env, "eagain", 6) == 0) {
+            schedule.eagain = v;
+        } else if (klen == 5 && memcmp(env, "short", 5) == 0) {
+            schedule.shortx = v;
+        } else if (klen == 5 && memcmp(env, "delay", 5) == 0) {
+            schedule.delay = v;
+        } else if (klen == 4 && memcmp(env, "usec", 4) == 0) {
+            schedule.usec = v;
+        }
+        env = *end == ',' ? end + 1 : end;
+    }
+    schedule.loaded = true;
+}
+
+
+// faultinject_random()
+//    Return the next pseudorandom number in the schedule. Each call
+//    hashes a shared counter (SplitMix64), so threads may call at once;
+//    single-threaded programs see the same sequence on every run.
+
+static unsigned long long faultinject_random() {
+    unsigned long long z = schedule.seed
+        + ++ncalls * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+
+// faultinject(fd, sz)
+//    Decide the fate of a transfer of `sz` bytes on `fd`. Returns -1
+//    if the call should fail with `errno` set; otherwise returns the
+//    number of bytes to transfer, which may be less than `sz`.
+
+static ssize_t faultinject(int fd, size_t sz) {
+    if (!schedule.loaded || fd == STDERR_FILENO || fd == 100) {
+        return sz;
+    }
+    unsigned long long r = faultinject_random();
+    unsigned pct = r % 100;
+    r /= 100;
+    if (pct < schedule.delay) {
+        struct timespec ts = {0, long(schedule.usec) * 1000};
+        nanosleep(&ts, nullptr);
+    }
+    pct = r % 100;
+    r /= 100;
+    if (pct < schedule.eintr) {
+        errno = EINTR;
+        return -1;
+    } else if (pct < schedule.eintr + schedule.eagain) {
+        errno = EAGAIN;
+        return -1;
+    }
+    pct = r % 100;
+    r /= 100;
+    if (pct < schedule.shortx && sz > 1) {
+        // O_DIRECT transfers are cut short only at block boundaries
+        int fl = fcntl(fd, F_GETFL);
+        if (fl >= 0 && (fl & O_DIRECT)) {
+            size_t nblocks = sz / 4096;
+            return nblocks > 1 ? (1 + r % (nblocks - 1)) * 4096 : sz;
+        }
+        return 1 + r % (sz - 1);
+    }
+    return sz;
+}
+
+
+extern "C" {
+
+ssize_t read(int fd, void* buf, size_t sz) {
+    ssize_t n = faultinject(fd, sz);
+    return n < 0 ? -1 : syscall(SYS_read, fd, buf, n);
+}
+
+ssize_t write(int fd, const void* buf, size_t sz) {
+    ssize_t n = faultinject(fd, sz);
+    return n < 0 ? -1 : syscall(SYS_write, fd, buf, n);
+}
+
+ssize_t pread(int fd, void* buf, size_t sz, off_t off) {
+    ssize_t n = faultinject(fd, sz);
+    return n < 0 ? -1 : syscall(SYS_pread64, fd, buf, n, off);
+}
+
+ssize_t pwrite(int fd, const void* buf, size_t sz, off_t off) {
+    ssize_t n = faultinject(fd, sz);
+    return n < 0 ? -1 : syscall(SYS_pwrite64, fd, buf, n, off);
+}
+
+// With _FORTIFY_SOURCE, calls with buffers of known size go here
+ssize_t __read_chk(int fd, void* buf, size_t sz, size_t buflen) {
+    if (sz > buflen) {
+        abort();
+    }
+    return read(fd, buf, sz);
+}
+
+ssize_t __pread_chk(int fd, void* buf, size_t sz, off_t off,
+                    size_t buflen) {
+    if (sz > buflen) {
+        abort();
+    }
+    return pread(fd, buf, sz, off);
+}
+
+}
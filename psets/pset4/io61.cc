@@ -1,43 +1,248 @@
 #include "io61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <climits>
+#include <ctime>
 #include <cerrno>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <thread>
 
 #define BUFSIZE 16384
+#define NBLOCKS 16
+#define DIRECT_ALIGN 4096   // alignment of O_DIRECT offsets, sizes, buffers
+#define NAGLE_DELAY 200000  // interactive coalescing delay, in ns
+#define ZBUFSIZE 65536      // compressed frame buffer size
+#define ZHASHBITS 12        // log2 of compressor hash table size
+#define COPYCHUNK 262144    // largest transfer made by `io61_copy`
+#define MMAP_MIN 65536      // smallest file that is mapped
+#define MMAP_POPULATE_MAX (16 << 20)    // largest file prefaulted at once
+#define MMAP_CHUNK (1 << 20)            // unit of prefaulting in larger files
+#define HUGEPAGE_SIZE (2 << 20)
+#define EAGAIN_WAIT 1       // longest wait for readiness after EAGAIN, in ms
 
 // io61.c
 //    YOUR CODE HERE!
 
 
+// io61_block, io61_bcache
+//    Block cache for positional I/O (`io61_pread` and `io61_pwrite`).
+//    It is separate from the sequential cache in `io61_file`, so that
+//    many threads can share one file. Each block has its own lock; the
+//    cache lock protects only the assignment of file offsets to blocks.
+//    A block's reference count pins it while a thread uses it, and
+//    only unpinned blocks are evicted. Statistics are atomic because
+//    threads update them under different block locks.
+//
+//    The two caches are kept coherent at the switch between sequential
+//    and positional I/O, which must not run at the same time. Each
+//    positional call first writes the sequential dirty range (and a
+//    `io61_pwrite` also empties the sequential window), so dirty blocks
+//    always hold older data than the sequential cache. Sequential
+//    flushes therefore write back and invalidate overlapping blocks
+//    first, and read/write refills write back all dirty blocks.
+
+struct io61_block {
+    std::mutex m;               // protects block contents
+    off_t off = -1;             // file offset of block, -1 if none
+    unsigned refs = 0;          // number of threads using block
+    unsigned long lru = 0;      // time of last use
+    bool valid = false;         // true iff `data` holds file contents
+    size_t len = 0;             // number of valid bytes in `data`
+    size_t dirty_lo = 0;        // range of dirty bytes in `data`
+    size_t dirty_hi = 0;
+    alignas(DIRECT_ALIGN) unsigned char data[BUFSIZE];
+};
+
+struct io61_bcache {
+    std::mutex m;               // protects `off`, `refs`, and `lru`
+    std::mutex stream_m;        // serializes `io61_stream_sync`
+    std::condition_variable cv; // signaled when a block is unpinned
+    unsigned long clock = 0;
+    io61_block blocks[NBLOCKS];
+    std::atomic<unsigned long long> cached_bytes{0};
+    std::atomic<unsigned long long> refills{0};
+    std::atomic<unsigned long long> reads{0};
+    std::atomic<unsigned long long> writes{0};
+    std::atomic<unsigned long long> flushes{0};
+    std::atomic<unsigned long long> flush_bytes{0};
+};
+
+static int io61_bcache_flush(io61_file* f);
+static int io61_bcache_evict(io61_file* f, off_t lo, off_t hi);
+static int io61_flush_stream(io61_file* f);
+
+
+// io61_zentry, io61_zstate
+//    State for compressed files (IO61_COMPRESSED). The format is
+//    described in the COMPRESSED FRAMES section below.
+
+struct io61_zentry {
+    off_t uoff;                 // uncompressed offset of frame
+    off_t coff;                 // file offset of frame header
+};
+
+struct io61_zstate {
+    unsigned char raw[ZBUFSIZE];    // compressed bytes
+    size_t rpos = 0;            // reading: next unread byte in `raw`
+    size_t rlen = 0;            // reading: end of data in `raw`
+    off_t coff = 0;             // writing: file offset of next frame
+    bool started = false;       // file header has been read or written
+    bool eof = false;           // reading: end marker has been read
+    bool indexed = false;       // reading: `index` has been loaded
+    off_t usize = 0;            // reading: uncompressed size
+    off_t cend = 0;             // reading: file offset of end marker
+    std::vector<io61_zentry> index;
+    uint32_t table[1 << ZHASHBITS]; // compressor hash table
+};
+
+static ssize_t io61_zfill(io61_file* f);
+static int io61_zflush(io61_file* f);
+static int io61_zfinish(io61_file* f);
+static int io61_zseek(io61_file* f, off_t pos);
+static int io61_zindex(io61_file* f);
+
+
 // io61_file
 //    Data structure for io61 file wrappers. Add your own stuff.
 
 struct io61_file {
     int fd;
-    unsigned char buf[BUFSIZE];
-    off_t tag;
-    off_t end_tag;
-    off_t pos_tag;
-    off_t seek_idx;
+    alignas(DIRECT_ALIGN) unsigned char buf[BUFSIZE];
+    off_t tag;          // file offset of first byte in cache
+    off_t end_tag;      // file offset one past last valid byte in cache
+    off_t pos_tag;      // file offset of next byte to read or write
+    off_t dirty_tag;    // file offset of first byte written but not flushed
+    off_t dirty_end;    // file offset one past last such byte
     int mode;
+    bool direct;        // true iff `fd` has O_DIRECT
+    int ufd;            // descriptor for unaligned transfers (`fd` if !direct)
+    bool interactive;   // true iff `fd` is a pipe or socket
+    unsigned long long flush_time;  // time of last flush, if interactive
+    unsigned long long dirty_time;  // when cache became dirty, if interactive
+    io61_file* iprev;   // links in `io61_interactive_writers`
+    io61_file* inext;
+    char* line;         // line buffer for lines that span cache refills
+    size_t linecap;     // capacity of `line`
+    io61_bcache* bcache;            // positional I/O cache, or nullptr
+    std::once_flag bcache_once;     // guards creation of `bcache`
+    io61_zstate* z;     // compression state, or nullptr
+    const unsigned char* rbuf;  // cache data for reading: `buf` or `map`
+    unsigned char* map; // mapping of whole file, or nullptr
+    size_t mapsize;
+    bool map_seq;       // mapping is advised MADV_SEQUENTIAL
+    off_t map_lo;       // range of mapping most recently advised
+    off_t map_hi;
+    off_t map_chunk;    // unit of advice after seeks
+    std::vector<bool> map_advised;  // chunks advised after seeks
+    io61_stats stats;
 };
 
+// Writable interactive files, which reads flush before blocking.
+static io61_file* io61_interactive_writers;
+static bool io61_nagle_expire();
+
+static void io61_map(io61_file* f, off_t size);
+static void io61_map_advise(io61_file* f, off_t pos);
+static int io61_unmap(io61_file* f);
+
 
 // io61_fdopen(fd, mode)
 //    Return a new io61_file for file descriptor `fd`. `mode` is
-//    either O_RDONLY for a read-only file or O_WRONLY for a
-//    write-only file. You need not support read/write files.
+//    either O_RDONLY for a read-only file, O_WRONLY for a write-only
+//    file, or O_RDWR for a read/write file. A read/write file keeps
+//    reads and writes in one cache window, so reads see buffered writes;
+//    it must be seekable.
+//
+//    Pipes and sockets are interactive. Before a read blocks on an
+//    interactive file for more than NAGLE_DELAY, buffered writes to all
+//    interactive files are flushed, since the data being waited for may
+//    be a response to them. Writes to an idle interactive file are sent
+//    at once; later writes are coalesced for about NAGLE_DELAY (see
+//    `io61_nagle`).
+//
+//    If `fd` was opened with O_DIRECT, transfers bypass the page cache.
+//    The cache is aligned for this, and all transfers use positional
+//    I/O. Transfers that are still unaligned, such as the tail of a
+//    file, go through a second descriptor without O_DIRECT.
+//
+//    If `mode` includes IO61_COMPRESSED, the file holds compressed
+//    frames. Writes must then be sequential, and read/write files
+//    cannot be compressed (the flag is ignored). Compressed files do
+//    not use O_DIRECT.
+//
+//    Other read-only regular files are mapped into memory if possible
+//    (see `io61_map`).
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
     io61_file* f = new io61_file;
     f->fd = fd;
     f->tag = 0;
-    f->end_tag = 0;
-    f->pos_tag = 0;
-    f->seek_idx = 0;
+    f->direct = false;
+    f->ufd = fd;
+    f->z = nullptr;
+    int fl = fcntl(fd, F_GETFL);
+    if ((mode & IO61_COMPRESSED) && (mode & O_ACCMODE) != O_RDWR) {
+        f->z = new io61_zstate;
+        if (fl >= 0 && (fl & O_DIRECT)) {
+            fl &= ~O_DIRECT;
+            fcntl(fd, F_SETFL, fl);
+        }
+    }
+    mode &= O_ACCMODE;
+    if (fl >= 0 && (fl & O_DIRECT)) {
+        char name[64];
+        snprintf(name, sizeof(name), "/proc/self/fd/%d", fd);
+        f->ufd = open(name, (fl & O_ACCMODE) | O_CLOEXEC);
+        off_t off = lseek(fd, 0, SEEK_CUR);
+        if (f->ufd >= 0 && off >= 0) {
+            f->direct = true;
+            f->tag = off;
+        } else {
+            // Can't handle unaligned transfers; give up on O_DIRECT
+            if (f->ufd >= 0) {
+                close(f->ufd);
+            }
+            f->ufd = fd;
+            fcntl(fd, F_SETFL, fl & ~O_DIRECT);
+        }
+    }
+    struct stat s;
+    bool stat_ok = fstat(fd, &s) >= 0;
+    f->interactive = stat_ok
+        && (S_ISFIFO(s.st_mode) || S_ISSOCK(s.st_mode));
+    f->flush_time = 0;
+    f->dirty_time = 0;
+    f->iprev = f->inext = nullptr;
+    if (f->interactive && mode != O_RDONLY) {
+        f->inext = io61_interactive_writers;
+        if (f->inext) {
+            f->inext->iprev = f;
+        }
+        io61_interactive_writers = f;
+    }
+    f->end_tag = f->tag;
+    f->pos_tag = f->tag;
+    f->dirty_tag = f->tag;
+    f->dirty_end = f->tag;
     f->mode = mode;
+    f->line = nullptr;
+    f->linecap = 0;
+    f->bcache = nullptr;
+    f->rbuf = f->buf;
+    f->map = nullptr;
+    f->mapsize = 0;
+    if (mode == O_RDONLY && !f->direct && !f->z
+        && stat_ok && S_ISREG(s.st_mode)) {
+        io61_map(f, s.st_size);
+    }
+    f->stats = io61_stats();
+    f->stats.files = 1;
     return f;
 }
 
@@ -47,8 +252,229 @@ io61_file* io61_fdopen(int fd, int mode) {
 
 int io61_close(io61_file* f) {
     io61_flush(f);
+    int zr = 0;
+    if (f->z && f->mode == O_WRONLY) {
+        zr = io61_zfinish(f);
+    }
+    if (f->inext) {
+        f->inext->iprev = f->iprev;
+    }
+    if (f->iprev) {
+        f->iprev->inext = f->inext;
+    } else if (io61_interactive_writers == f) {
+        io61_interactive_writers = f->inext;
+    }
+    io61_nagle_expire();
     int r = close(f->fd);
+    if (f->ufd != f->fd) {
+        close(f->ufd);
+    }
+    if (f->map) {
+        munmap(f->map, f->mapsize);
+    }
+    if (io61_bcache* bc = f->bcache) {
+        f->stats.cached_bytes += bc->cached_bytes;
+        f->stats.refills += bc->refills;
+        f->stats.reads += bc->reads;
+        f->stats.writes += bc->writes;
+        f->stats.flushes += bc->flushes;
+        f->stats.flush_bytes += bc->flush_bytes;
+    }
+    io61_stats_total.add(f->stats);
+    delete[] f->line;
+    delete f->bcache;
+    delete f->z;
     delete f;
+    return zr < 0 ? -1 : r;
+}
+
+
+// io61_sysread(fd, buf, sz), io61_syswrite(fd, buf, sz),
+// io61_syspread(fd, buf, sz, off), io61_syspwrite(fd, buf, sz, off)
+//    Like `read`, `write`, `pread`, and `pwrite`, but retry calls
+//    interrupted by a signal (EINTR), and wait with `poll` and retry
+//    if a nonblocking descriptor is not ready (EAGAIN). The wait is
+//    bounded by EAGAIN_WAIT, because readiness can be stricter than a
+//    transfer needs: a Unix socket polls writable only once most of its
+//    buffer is free, which two processes exchanging data might never
+//    allow. Transfers may still be short; callers loop as needed.
+
+static bool io61_retry(int fd, short events) {
+    if (errno == EINTR) {
+        return true;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = {fd, events, 0};
+        poll(&pfd, 1, EAGAIN_WAIT);
+        return true;
+    }
+    return false;
+}
+
+static ssize_t io61_sysread(int fd, void* buf, size_t sz) {
+    ssize_t r;
+    while ((r = read(fd, buf, sz)) < 0 && io61_retry(fd, POLLIN)) {
+    }
+    return r;
+}
+
+static ssize_t io61_syswrite(int fd, const void* buf, size_t sz) {
+    ssize_t r;
+    while ((r = write(fd, buf, sz)) < 0 && io61_retry(fd, POLLOUT)) {
+    }
+    return r;
+}
+
+static ssize_t io61_syspread(int fd, void* buf, size_t sz, off_t off) {
+    ssize_t r;
+    while ((r = pread(fd, buf, sz, off)) < 0 && io61_retry(fd, POLLIN)) {
+    }
+    return r;
+}
+
+static ssize_t io61_syspwrite(int fd, const void* buf, size_t sz,
+                              off_t off) {
+    ssize_t r;
+    while ((r = pwrite(fd, buf, sz, off)) < 0 && io61_retry(fd, POLLOUT)) {
+    }
+    return r;
+}
+
+
+// io61_fd(f, buf, sz, off)
+//    Return the descriptor to use for transferring `sz` bytes between
+//    `buf` and file offset `off`. O_DIRECT requires all three to be
+//    aligned.
+
+static inline int io61_fd(io61_file* f, const void* buf, size_t sz,
+                          off_t off) {
+    if (f->direct
+        && ((uintptr_t) buf | sz | (uintptr_t) off) % DIRECT_ALIGN != 0) {
+        return f->ufd;
+    }
+    return f->fd;
+}
+
+
+// io61_now()
+//    Return the current time in nanoseconds.
+
+static inline unsigned long long io61_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// io61_nagle_expire()
+//    Flush every interactive file whose buffered data has waited
+//    NAGLE_DELAY. Returns true if some interactive file still has
+//    buffered data.
+
+static bool io61_nagle_expire() {
+    bool dirty = false;
+    unsigned long long now = 0;
+    for (io61_file* w = io61_interactive_writers; w; w = w->inext) {
+        if (w->dirty_tag != w->dirty_end) {
+            now = now ? now : io61_now();
+            if (now - w->dirty_time >= NAGLE_DELAY) {
+                io61_flush_stream(w);
+            }
+            dirty = dirty || w->dirty_tag != w->dirty_end;
+        }
+    }
+    return dirty;
+}
+
+
+// io61_before_block(f)
+//    Called before reading from interactive file `f`. Flushes files
+//    whose data has waited NAGLE_DELAY. Then, if no data arrives on `f`
+//    within NAGLE_DELAY, flushes all interactive files with buffered
+//    writes, so that a request/response exchange cannot stall with a
+//    request sitting in a cache. The short wait lets streaming
+//    pipelines keep writing full buffers.
+
+static void io61_before_block(io61_file* f) {
+    if (!io61_nagle_expire()) {
+        return;
+    }
+    struct pollfd pfd = {f->fd, POLLIN, 0};
+    struct timespec delay = {0, NAGLE_DELAY};
+    if (ppoll(&pfd, 1, &delay, nullptr) == 1) {
+        return;
+    }
+    for (io61_file* w = io61_interactive_writers; w; w = w->inext) {
+        io61_flush_stream(w);
+    }
+}
+
+
+// io61_nagle(f)
+//    Called after writing to interactive file `f`. Like Nagle's
+//    algorithm, the first write after an idle period (no flush for
+//    NAGLE_DELAY) is sent at once. Later writes are coalesced until
+//    NAGLE_DELAY has passed since the cache became dirty; then the next
+//    write, blocking read, or close sends them. io61 has no timer, so
+//    data written just before a program stops calling io61 waits for
+//    its next call. Errors are reported by the next flush.
+
+static void io61_nagle(io61_file* f) {
+    if (f->dirty_tag == f->dirty_end) {
+        return;
+    }
+    unsigned long long now = io61_now();
+    if (f->dirty_time == 0 && now - f->flush_time < NAGLE_DELAY) {
+        // Cache just became dirty; start the delay
+        f->dirty_time = now;
+    } else if (f->dirty_time == 0 || now - f->dirty_time >= NAGLE_DELAY) {
+        io61_flush_stream(f);
+    }
+}
+
+
+// io61_fill(f)
+//    Refill the cache of `f` starting at the end of the current cache.
+//    Any dirty data, including dirty positional blocks of a read/write
+//    file, is flushed first. Returns the number of bytes read, which is
+//    0 at end-of-file, or -1 on error.
+
+static ssize_t io61_fill(io61_file* f) {
+    if (f->map) {
+        // End of mapping: if the file has grown since it was mapped,
+        // read the rest normally
+        struct stat s;
+        if (fstat(f->fd, &s) < 0 || s.st_size <= off_t(f->mapsize)
+            || io61_unmap(f) < 0) {
+            return 0;
+        }
+    }
+
+    // Check invariants
+    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
+    assert(f->end_tag - f->tag <= BUFSIZE);
+
+    if (io61_flush_stream(f) < 0
+        || (f->bcache && f->mode == O_RDWR && io61_bcache_flush(f) < 0)) {
+        return -1;
+    }
+    f->tag = f->pos_tag = f->end_tag;
+    ++f->stats.refills;
+    ++f->stats.reads;
+    ssize_t r;
+    if (f->z) {
+        r = io61_zfill(f);
+    } else if (f->mode == O_RDWR || f->direct) {
+        r = io61_syspread(io61_fd(f, f->buf, BUFSIZE, f->tag), f->buf,
+                          BUFSIZE, f->tag);
+    } else {
+        if (f->interactive) {
+            io61_before_block(f);
+        }
+        r = io61_sysread(f->fd, f->buf, BUFSIZE);
+    }
+    if (r > 0) {
+        f->end_tag += r;
+    }
     return r;
 }
 
@@ -62,23 +488,13 @@ int io61_readc(io61_file* f) {
         return -1;
     }
 
-    if (f->pos_tag + 1 <= f->end_tag) {
-        // Within cache
-        f->pos_tag += 1;
-        return *(f->buf + f->pos_tag - f->tag - 1);
-    } else {
-        // Read and refill cache
-        f->tag = f->pos_tag = f->end_tag;
-        ssize_t total_read = read(f->fd, f->buf, BUFSIZE);
-        if (total_read == 0) {
-            return EOF;
-        }
-        f->end_tag += total_read;
-        f->pos_tag += 1;
-        unsigned char c = f->buf[f->seek_idx];
-        f->seek_idx = 0;
-        return c;
+    if (f->pos_tag == f->end_tag && io61_fill(f) <= 0) {
+        return EOF;
     }
+    unsigned char ch = f->rbuf[f->pos_tag - f->tag];
+    ++f->pos_tag;
+    ++f->stats.cached_bytes;
+    return ch;
 }
 
 
@@ -94,58 +510,183 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
         return -1;
     }
 
-    ssize_t sz_read = 0;
-    
-    // Check invariants
-    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-    assert(f->end_tag - f->pos_tag <= BUFSIZE);
-
-    if (sz <= BUFSIZE && (ssize_t) (f->pos_tag + sz) <= f->end_tag) {
-        // Wholly within cache
-        memcpy(buf, f->buf + f->pos_tag - f->tag, sz);
-        f->pos_tag += sz;
-        sz_read = sz;
-    } else if ((ssize_t) sz <= BUFSIZE - f->seek_idx) {
-        ssize_t sz_to_copy = sz;
-        if (f->end_tag > f->pos_tag) {
-            // Dump rest of cache
-            sz_read = f->end_tag - f->pos_tag;
-            memcpy(buf, f->buf + f->pos_tag - f->tag, sz_read);
-            sz_to_copy -= sz_read;
-        }
-        // Cache empty/full; refill
-        f->tag = f->pos_tag = f->end_tag;
-        ssize_t total_read = read(f->fd, f->buf, BUFSIZE);
-        if (total_read < 0) {
-            return -1;
+    size_t sz_read = 0;
+    while (sz_read != sz) {
+        if (f->pos_tag == f->end_tag) {
+            ssize_t r;
+            if (sz - sz_read >= BUFSIZE && f->mode == O_RDONLY
+                && !f->direct && !f->z && !f->map) {
+                // Too large for cache; read directly into `buf`
+                if (f->interactive) {
+                    io61_before_block(f);
+                }
+                r = io61_sysread(f->fd, buf + sz_read, sz - sz_read);
+                ++f->stats.reads;
+                if (r > 0) {
+                    f->tag = f->pos_tag = f->end_tag = f->end_tag + r;
+                    sz_read += r;
+                    continue;
+                }
+            } else {
+                r = io61_fill(f);
+            }
+            if (r < 0) {
+                return sz_read == 0 ? -1 : sz_read;
+            } else if (r == 0) {
+                break;
+            }
         }
-        f->end_tag += total_read;
-        sz_to_copy = total_read >= sz_to_copy ? sz_to_copy : total_read;
-        memcpy(buf + sz_read, f->buf + f->seek_idx, sz_to_copy);
-        sz_read += sz_to_copy;
-        f->pos_tag += sz_to_copy;
-        f->seek_idx = 0;
-    } else {
-        // Too large for cache
-        if (f->end_tag > f->pos_tag) {
-            // Dump rest of cache
-            sz_read = f->end_tag - f->pos_tag;
-            memcpy(buf, f->buf + f->pos_tag - f->tag, sz_read);
-        }
-        // Read the remaining directly
-        ssize_t r = read(f->fd, buf + sz_read, sz - sz_read);
-        if (r < 0) {
-            return sz_read == 0 ? -1 : sz_read;
+
+        // Copy from cache
+        size_t n = f->end_tag - f->pos_tag;
+        if (n > sz - sz_read) {
+            n = sz - sz_read;
+        }
+        memcpy(buf + sz_read, f->rbuf + f->pos_tag - f->tag, n);
+        f->pos_tag += n;
+        f->stats.cached_bytes += n;
+        sz_read += n;
+    }
+    return sz_read;
+}
+
+
+// io61_readline(f, line)
+//    Read one line from `f`, including its terminating newline, and set
+//    `*line` to point at its first character. The line is returned
+//    directly from `f`'s cache when it fits there; otherwise it is
+//    assembled in a per-file line buffer. Either way, `*line` is valid
+//    only until the next call on `f`. Returns the line's length, which
+//    is 0 at end-of-file, or -1 if an error occurred before any
+//    characters were read. The last line of a file may lack a newline.
+
+ssize_t io61_readline(io61_file* f, const char** line) {
+    if (f->mode == O_WRONLY) {
+        return -1;
+    }
+
+    size_t len = 0;
+    while (true) {
+        if (f->pos_tag == f->end_tag) {
+            ssize_t r = io61_fill(f);
+            if (r < 0 && len == 0) {
+                return -1;
+            } else if (r <= 0) {
+                break;
+            }
+        }
+
+        // `memchr` is vectorized by the C library, so this scans the
+        // cache at close to memory bandwidth
+        const unsigned char* p = f->rbuf + f->pos_tag - f->tag;
+        size_t avail = f->end_tag - f->pos_tag;
+        auto nl = (const unsigned char*) memchr(p, '\n', avail);
+        size_t n = nl ? nl + 1 - p : avail;
+        f->pos_tag += n;
+        f->stats.cached_bytes += n;
+
+        if (nl && len == 0) {
+            // Whole line is in cache: no copy needed
+            *line = (const char*) p;
+            return n;
+        }
+
+        // Line spans a refill: append to line buffer
+        if (len + n > f->linecap) {
+            size_t cap = f->linecap ? f->linecap : 256;
+            while (cap < len + n) {
+                cap *= 2;
+            }
+            char* newline = new char[cap];
+            memcpy(newline, f->line, len);
+            delete[] f->line;
+            f->line = newline;
+            f->linecap = cap;
+        }
+        memcpy(f->line + len, p, n);
+        len += n;
+        if (nl) {
+            break;
         }
-        sz_read += r;
-        f->tag = f->pos_tag = f->end_tag = f->end_tag + r + f->seek_idx;
-        f->seek_idx = 0;
     }
+    *line = f->line;
+    return len;
+}
+
+
+// io61_getline(f, buf, sz)
+//    Read characters from `f` into `buf` up to and including the next
+//    newline, but not more than `sz` characters. Returns the number of
+//    characters read, which is 0 at end-of-file, or -1 if an error
+//    occurred before any characters were read.
+
+ssize_t io61_getline(io61_file* f, char* buf, size_t sz) {
+    if (f->mode == O_WRONLY) {
+        return -1;
+    }
+
+    size_t sz_read = 0;
+    while (sz_read != sz) {
+        if (f->pos_tag == f->end_tag) {
+            ssize_t r = io61_fill(f);
+            if (r < 0) {
+                return sz_read == 0 ? -1 : sz_read;
+            } else if (r == 0) {
+                break;
+            }
+        }
 
+        const unsigned char* p = f->rbuf + f->pos_tag - f->tag;
+        size_t avail = f->end_tag - f->pos_tag;
+        if (avail > sz - sz_read) {
+            avail = sz - sz_read;
+        }
+        auto nl = (const unsigned char*) memchr(p, '\n', avail);
+        size_t n = nl ? nl + 1 - p : avail;
+        memcpy(buf + sz_read, p, n);
+        f->pos_tag += n;
+        f->stats.cached_bytes += n;
+        sz_read += n;
+        if (nl) {
+            break;
+        }
+    }
     return sz_read;
 }
 
 
+// io61_mark_dirty(f, start, end)
+//    Record that file offsets [`start`, `end`) were written into the
+//    cache of `f`. Dirty data is tracked as one range, which may cover
+//    some clean bytes between separate writes.
+
+static inline void io61_mark_dirty(io61_file* f, off_t start, off_t end) {
+    if (f->dirty_tag == f->dirty_end) {
+        f->dirty_tag = start;
+        f->dirty_end = end;
+    } else {
+        f->dirty_tag = start < f->dirty_tag ? start : f->dirty_tag;
+        f->dirty_end = end > f->dirty_end ? end : f->dirty_end;
+    }
+}
+
+
+// io61_slide(f)
+//    Make room to write at `f->pos_tag`. If the cache window is full,
+//    flush it and start a new, empty window there. Returns 0 on success
+//    or -1 on error.
+
+static int io61_slide(io61_file* f) {
+    if (f->pos_tag == f->tag + BUFSIZE) {
+        if (io61_flush_stream(f) < 0) {
+            return -1;
+        }
+        f->tag = f->end_tag = f->pos_tag;
+    }
+    return 0;
+}
+
+
 // io61_writec(f)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
@@ -155,21 +696,25 @@ int io61_writec(io61_file* f, int ch) {
         return -1;
     }
 
-    const ssize_t filled_sz = f->pos_tag - f->tag;
-
-    if (filled_sz + 1 <= BUFSIZE) {
-        f->buf[filled_sz] = ch;
-    } else {
-        if (io61_flush(f) < 0) {
-            return -1;
+    off_t pos = f->pos_tag;
+    if (pos == f->dirty_end && pos < f->tag + BUFSIZE) {
+        // Common case: append to dirty range
+        f->buf[pos - f->tag] = ch;
+        f->pos_tag = f->dirty_end = pos + 1;
+        if (pos == f->end_tag) {
+            f->end_tag = pos + 1;
         }
-        f->buf[0] = ch;
+        ++f->stats.cached_bytes;
+        // Interactive files check the coalescing delay only at newlines,
+        // so a line written by characters is sent whole
+        if (f->interactive && ch == '\n') {
+            io61_nagle(f);
+        }
+        return 0;
+    } else {
+        char c = ch;
+        return io61_write(f, &c, 1) == 1 ? 0 : -1;
     }
-
-    f->pos_tag += 1;
-    f->end_tag += 1;
-
-    return 0;
 }
 
 
@@ -183,44 +728,47 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
         return -1;
     }
 
-    ssize_t sz_wrtn = sz;
-
     // Check invariants
     assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-    assert(f->end_tag - f->pos_tag <= BUFSIZE);
-    assert(f->pos_tag == f->end_tag);
-
-    const ssize_t filled_sz = f->pos_tag - f->tag;
-    const ssize_t empty_sz = BUFSIZE - filled_sz;
-
-    if (sz <= BUFSIZE && (ssize_t) sz <= empty_sz) {
-        // Wholly within cache
-        memcpy(f->buf + filled_sz, buf, sz);
-        f->pos_tag += sz;
-        f->end_tag += sz;
-    } else if (sz <= BUFSIZE) {
-        // Fill up rest of cache, flush, and refill
-        memcpy(f->buf + filled_sz, buf, empty_sz);
-        f->pos_tag += empty_sz;
-        f->end_tag += empty_sz;
-        if (io61_flush(f) < 0) {
-            return -1;
-        };
-        memcpy(f->buf, buf + empty_sz, sz - empty_sz);
-        f->pos_tag += sz - empty_sz;
-        f->end_tag += sz - empty_sz;
-    } else {
-        // Too large for cache
-        if (io61_flush(f) < 0) {
-            return -1;
-        };
-        sz_wrtn = write(f->fd, buf, sz);
-        if (sz_wrtn < 0) {
-            return -1;
+    assert(f->end_tag - f->tag <= BUFSIZE);
+
+    size_t sz_wrtn = 0;
+    while (sz_wrtn != sz) {
+        if (sz - sz_wrtn >= BUFSIZE && f->mode == O_WRONLY
+            && !f->direct && !f->z) {
+            // Too large for cache; write directly from `buf`
+            if (io61_flush_stream(f) < 0) {
+                return sz_wrtn == 0 ? -1 : sz_wrtn;
+            }
+            ssize_t w = io61_syswrite(f->fd, buf + sz_wrtn, sz - sz_wrtn);
+            ++f->stats.writes;
+            if (w < 0) {
+                return sz_wrtn == 0 ? -1 : sz_wrtn;
+            }
+            f->tag = f->pos_tag = f->end_tag = f->pos_tag + w;
+            sz_wrtn += w;
+            continue;
         }
-        f->tag = f->pos_tag = f->end_tag = f->end_tag + sz_wrtn;
-    }
 
+        if (io61_slide(f) < 0) {
+            return sz_wrtn == 0 ? -1 : sz_wrtn;
+        }
+        size_t n = f->tag + BUFSIZE - f->pos_tag;
+        if (n > sz - sz_wrtn) {
+            n = sz - sz_wrtn;
+        }
+        memcpy(f->buf + f->pos_tag - f->tag, buf + sz_wrtn, n);
+        io61_mark_dirty(f, f->pos_tag, f->pos_tag + n);
+        f->pos_tag += n;
+        f->stats.cached_bytes += n;
+        if (f->pos_tag > f->end_tag) {
+            f->end_tag = f->pos_tag;
+        }
+        sz_wrtn += n;
+    }
+    if (f->interactive) {
+        io61_nagle(f);
+    }
     return sz_wrtn;
 }
 
@@ -228,26 +776,64 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 // io61_flush(f)
 //    Forces a write of all buffered data written to `f`.
 //    If `f` was opened read-only, io61_flush(f) may either drop all
-//    data buffered for reading, or do nothing.
+//    data buffered for reading, or do nothing. For a read/write file,
+//    only the dirty range is written, and the cache stays valid.
+//    Dirty blocks in the positional I/O cache are written too.
 
 int io61_flush(io61_file* f) {
-    if (f->mode == O_RDONLY) {
+    int r = io61_flush_stream(f);
+    if (f->bcache && io61_bcache_flush(f) < 0) {
+        r = -1;
+    }
+    return r;
+}
+
+
+// io61_flush_stream(f)
+//    Write the dirty range of `f`'s sequential cache. Returns 0 on
+//    success or -1 on error.
+
+static int io61_flush_stream(io61_file* f) {
+    if (f->mode == O_RDONLY || f->dirty_tag == f->dirty_end) {
         return 0;
     }
 
     // Check invariants
-    assert(f->tag <= f->pos_tag && f->pos_tag <= f->end_tag);
-    assert(f->end_tag - f->pos_tag <= BUFSIZE);
-    assert(f->pos_tag == f->end_tag);
+    assert(f->tag <= f->dirty_tag && f->dirty_tag < f->dirty_end);
+    assert(f->dirty_end <= f->end_tag);
 
-    if (f->pos_tag - f->tag) {
-        ssize_t sz = write(f->fd, f->buf, f->pos_tag - f->tag);
-        if (sz < 0) {
+    if (f->bcache && io61_bcache_evict(f, f->dirty_tag, f->dirty_end) < 0) {
+        return -1;
+    }
+    ++f->stats.flushes;
+    f->stats.flush_bytes += f->dirty_end - f->dirty_tag;
+    if (f->z && io61_zflush(f) < 0) {
+        return -1;
+    }
+    while (f->dirty_tag != f->dirty_end) {
+        const unsigned char* p = f->buf + f->dirty_tag - f->tag;
+        size_t sz = f->dirty_end - f->dirty_tag;
+        ssize_t w;
+        if (f->mode == O_RDWR || f->direct) {
+            w = io61_syspwrite(io61_fd(f, p, sz, f->dirty_tag), p, sz,
+                               f->dirty_tag);
+        } else {
+            w = io61_syswrite(f->fd, p, sz);
+        }
+        ++f->stats.writes;
+        if (w < 0) {
             return -1;
         }
-        assert(sz == f->pos_tag - f->tag);
-        f->tag += sz;
-        return sz;
+        f->dirty_tag += w;
+    }
+    if (f->interactive) {
+        f->flush_time = io61_now();
+        f->dirty_time = 0;
+    }
+
+    // A write-only file has no further use for written data
+    if (f->mode == O_WRONLY) {
+        f->tag = f->end_tag;
     }
     return 0;
 }
@@ -258,59 +844,1056 @@ int io61_flush(io61_file* f) {
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t pos) {
-    if (f->mode == O_RDONLY) {
-        if (pos >= f->tag && pos < f->end_tag) {
+    f->stats.seek_distance += pos > f->pos_tag ? pos - f->pos_tag
+                                                : f->pos_tag - pos;
+    if (f->z) {
+        return io61_zseek(f, pos);
+    }
+    if (f->mode == O_WRONLY) {
+        ++f->stats.lseeks;
+        if (io61_flush_stream(f) < 0 || lseek(f->fd, pos, SEEK_SET) != pos) {
+            return -1;
+        }
+        f->tag = f->pos_tag = f->end_tag = pos;
+        return 0;
+    }
+    if (f->map) {
+        if (pos >= 0 && pos <= f->end_tag) {
+            // The whole file is cached
+            if (pos != f->pos_tag && (pos < f->map_lo || pos >= f->map_hi)) {
+                io61_map_advise(f, pos);
+            }
             f->pos_tag = pos;
             return 0;
-        } else {
-            off_t aligned = pos - pos % BUFSIZE;
-            if (lseek(f->fd, aligned, SEEK_SET) != aligned) {
-                return -1;
-            }
-            f->tag = f->pos_tag = f->end_tag = aligned;
-            f->seek_idx = pos - aligned;
+        } else if (io61_unmap(f) < 0) {
+            return -1;
         }
-    } else {
-        io61_flush(f);
-        if (lseek(f->fd, pos, SEEK_SET) != pos) {
+    }
+
+    if (pos >= f->tag
+        && (pos < f->end_tag
+            || (pos == f->end_tag && f->mode == O_RDWR))) {
+        f->pos_tag = pos;
+        return 0;
+    }
+
+    // Refill the aligned block containing `pos`, so that reverse
+    // and strided access patterns reuse the cache. Read/write files
+    // use positional I/O and need no `lseek`.
+    off_t aligned = pos - pos % BUFSIZE;
+    f->stats.lseeks += f->mode == O_RDONLY;
+    if (io61_flush_stream(f) < 0
+        || (f->mode == O_RDONLY
+            && lseek(f->fd, aligned, SEEK_SET) != aligned)) {
+        return -1;
+    }
+    f->tag = f->pos_tag = f->end_tag = aligned;
+    if (io61_fill(f) < 0) {
+        return -1;
+    }
+    if (pos > f->end_tag) {
+        // Past end of file
+        f->stats.lseeks += f->mode == O_RDONLY;
+        if (f->mode == O_RDONLY && lseek(f->fd, pos, SEEK_SET) != pos) {
             return -1;
         }
-        f->tag = f->pos_tag = f->end_tag = pos;
+        f->tag = f->end_tag = pos;
     }
+    f->pos_tag = pos;
     return 0;
 }
 
 
-// You shouldn't need to change these functions.
+// POSITIONAL I/O
 
-// io61_open_check(filename, mode)
-//    Open the file corresponding to `filename` and return its io61_file.
-//    If `!filename`, returns either the standard input or the
-//    standard output, depending on `mode`. Exits with an error message if
-//    `filename != nullptr` and the named file cannot be opened.
+// io61_block_writeback(f, b)
+//    Write the dirty bytes of locked block `b`. Returns 0 on success or
+//    -1 on error.
 
-io61_file* io61_open_check(const char* filename, int mode) {
-    int fd;
-    if (filename) {
-        fd = open(filename, mode, 0666);
-    } else if ((mode & O_ACCMODE) == O_RDONLY) {
-        fd = STDIN_FILENO;
-    } else {
-        fd = STDOUT_FILENO;
+static int io61_block_writeback(io61_file* f, io61_block* b) {
+    if (b->dirty_lo != b->dirty_hi) {
+        ++f->bcache->flushes;
+        f->bcache->flush_bytes += b->dirty_hi - b->dirty_lo;
     }
-    if (fd < 0) {
-        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
-        exit(1);
+    while (b->dirty_lo != b->dirty_hi) {
+        const unsigned char* p = b->data + b->dirty_lo;
+        size_t sz = b->dirty_hi - b->dirty_lo;
+        off_t off = b->off + b->dirty_lo;
+        ssize_t w = io61_syspwrite(io61_fd(f, p, sz, off), p, sz, off);
+        ++f->bcache->writes;
+        if (w < 0) {
+            return -1;
+        }
+        b->dirty_lo += w;
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    b->dirty_lo = b->dirty_hi = 0;
+    return 0;
 }
 
 
-// io61_filesize(f)
-//    Return the size of `f` in bytes. Returns -1 if `f` does not have a
-//    well-defined size (for instance, if it is a pipe).
+// io61_block_get(f, off)
+//    Return the block of `f`'s positional cache for aligned file offset
+//    `off`, pinned and locked. If no block holds `off`, evicts the
+//    least recently used unpinned block, waiting if every block is
+//    pinned. The returned block might not be `valid`. Returns nullptr
+//    if a dirty victim could not be written back.
 
-off_t io61_filesize(io61_file* f) {
+static io61_block* io61_block_get(io61_file* f, off_t off) {
+    io61_bcache* bc = f->bcache;
+    std::unique_lock<std::mutex> guard(bc->m);
+    while (true) {
+        io61_block* victim = nullptr;
+        for (auto& b : bc->blocks) {
+            if (b.off == off) {
+                // A pinned block keeps its offset, so it is safe to
+                // drop the cache lock before waiting for the block lock
+                ++b.refs;
+                b.lru = ++bc->clock;
+                guard.unlock();
+                b.m.lock();
+                return &b;
+            }
+            if (b.refs == 0 && (!victim || b.lru < victim->lru)) {
+                victim = &b;
+            }
+        }
+
+        if (victim && victim->dirty_lo != victim->dirty_hi) {
+            // Write back a dirty victim without holding the cache lock,
+            // then look again: another thread may have used the block
+            ++victim->refs;
+            guard.unlock();
+            victim->m.lock();
+            int r = io61_block_writeback(f, victim);
+            victim->m.unlock();
+            guard.lock();
+            if (--victim->refs == 0) {
+                bc->cv.notify_one();
+            }
+            if (r < 0) {
+                return nullptr;
+            }
+        } else if (victim) {
+            // Unpinned blocks are unlocked, so this does not block
+            victim->m.lock();
+            victim->off = off;
+            victim->valid = false;
+            victim->len = 0;
+            ++victim->refs;
+            victim->lru = ++bc->clock;
+            return victim;
+        } else {
+            bc->cv.wait(guard);
+        }
+    }
+}
+
+
+// io61_block_put(f, b)
+//    Unlock and unpin block `b`.
+
+static void io61_block_put(io61_file* f, io61_block* b) {
+    b->m.unlock();
+    std::lock_guard<std::mutex> guard(f->bcache->m);
+    if (--b->refs == 0) {
+        f->bcache->cv.notify_one();
+    }
+}
+
+
+// io61_block_load(f, b)
+//    Make locked block `b` valid by reading its contents from the file.
+//    Blocks of write-only files start out empty instead. Returns 0 on
+//    success or -1 on error.
+
+static int io61_block_load(io61_file* f, io61_block* b) {
+    if (b->valid) {
+        return 0;
+    }
+    b->len = 0;
+    if (f->mode != O_WRONLY) {
+        ++f->bcache->refills;
+    }
+    while (f->mode != O_WRONLY && b->len != BUFSIZE) {
+        unsigned char* p = b->data + b->len;
+        size_t sz = BUFSIZE - b->len;
+        off_t off = b->off + b->len;
+        ssize_t r = io61_syspread(io61_fd(f, p, sz, off), p, sz, off);
+        ++f->bcache->reads;
+        if (r < 0) {
+            return -1;
+        } else if (r == 0) {
+            break;
+        }
+        b->len += r;
+    }
+    b->valid = true;
+    return 0;
+}
+
+
+// io61_bcache_flush(f)
+//    Write all dirty blocks in `f`'s positional cache. Returns 0 on
+//    success or -1 on error.
+
+static int io61_bcache_flush(io61_file* f) {
+    std::lock_guard<std::mutex> guard(f->bcache->m);
+    int r = 0;
+    for (auto& b : f->bcache->blocks) {
+        // Threads unlock a block before taking the cache lock, so
+        // waiting for the block lock here cannot deadlock
+        std::lock_guard<std::mutex> bguard(b.m);
+        if (io61_block_writeback(f, &b) < 0) {
+            r = -1;
+        }
+    }
+    return r;
+}
+
+
+// io61_bcache_evict(f, lo, hi)
+//    Write back and invalidate the blocks of `f`'s positional cache
+//    that overlap file offsets [`lo`, `hi`), before the sequential
+//    cache writes newer data there. Returns 0 on success or -1 on error.
+
+static int io61_bcache_evict(io61_file* f, off_t lo, off_t hi) {
+    std::lock_guard<std::mutex> guard(f->bcache->m);
+    int r = 0;
+    for (auto& b : f->bcache->blocks) {
+        if (b.off >= 0 && b.off < hi && b.off + BUFSIZE > lo) {
+            std::lock_guard<std::mutex> bguard(b.m);
+            if (io61_block_writeback(f, &b) < 0) {
+                r = -1;
+            }
+            b.valid = false;
+        }
+    }
+    return r;
+}
+
+
+// io61_stream_sync(f, drop)
+//    Called before positional I/O on `f`. Writes the dirty range of the
+//    sequential cache, so that blocks see it. If `drop` is true, also
+//    empties a read/write file's sequential window, so that sequential
+//    reads refill after positional writes. Returns 0 on success or -1
+//    on error.
+
+static int io61_stream_sync(io61_file* f, bool drop) {
+    if (f->mode == O_RDONLY) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(f->bcache->stream_m);
+    if (io61_flush_stream(f) < 0) {
+        return -1;
+    }
+    if (drop && f->mode == O_RDWR) {
+        f->tag = f->end_tag = f->pos_tag;
+    }
+    return 0;
+}
+
+
+// io61_pread(f, buf, sz, off)
+//    Read up to `sz` characters from `f` into `buf`, starting at file
+//    offset `off`. Does not change `f`'s file position, and may be
+//    called by many threads at once, but not while a thread uses the
+//    sequential functions on `f`. Returns the number of characters
+//    read, which is short only at end-of-file, or -1 if an error
+//    occurred before any characters were read.
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    if (f->mode == O_WRONLY || f->z) {
+        return -1;
+    }
+    std::call_once(f->bcache_once, [f] { f->bcache = new io61_bcache; });
+    if (io61_stream_sync(f, false) < 0) {
+        return -1;
+    }
+
+    size_t sz_read = 0;
+    if (f->map && off >= 0 && off < off_t(f->mapsize)) {
+        // The mapping is read-only and fixed, so it needs no locks
+        sz_read = std::min(sz, size_t(f->mapsize - off));
+        memcpy(buf, f->map + off, sz_read);
+        f->bcache->cached_bytes += sz_read;
+    }
+    while (sz_read != sz) {
+        off_t boff = (off + sz_read) - (off + sz_read) % BUFSIZE;
+        io61_block* b = io61_block_get(f, boff);
+        if (!b) {
+            return sz_read == 0 ? -1 : sz_read;
+        } else if (io61_block_load(f, b) < 0) {
+            io61_block_put(f, b);
+            return sz_read == 0 ? -1 : sz_read;
+        }
+
+        size_t bpos = off + sz_read - boff;
+        size_t n = 0;
+        if (bpos < b->len) {
+            n = b->len - bpos;
+            if (n > sz - sz_read) {
+                n = sz - sz_read;
+            }
+            memcpy(buf + sz_read, b->data + bpos, n);
+            f->bcache->cached_bytes += n;
+        }
+        bool eof = b->len != BUFSIZE && bpos + n >= b->len;
+        io61_block_put(f, b);
+
+        sz_read += n;
+        if (eof) {
+            break;
+        }
+    }
+    return sz_read;
+}
+
+
+// io61_pwrite(f, buf, sz, off)
+//    Write `sz` characters from `buf` to `f`, starting at file offset
+//    `off`. Does not change `f`'s file position, and may be called by
+//    many threads at once, but not while a thread uses the sequential
+//    functions on `f`. Returns the number of characters written, or -1
+//    if an error occurred before any characters were written.
+
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off) {
+    if (f->mode == O_RDONLY || f->z) {
+        return -1;
+    }
+    std::call_once(f->bcache_once, [f] { f->bcache = new io61_bcache; });
+    if (io61_stream_sync(f, true) < 0) {
+        return -1;
+    }
+
+    size_t sz_wrtn = 0;
+    while (sz_wrtn != sz) {
+        off_t boff = (off + sz_wrtn) - (off + sz_wrtn) % BUFSIZE;
+        size_t bpos = off + sz_wrtn - boff;
+        size_t n = BUFSIZE - bpos;
+        if (n > sz - sz_wrtn) {
+            n = sz - sz_wrtn;
+        }
+
+        io61_block* b = io61_block_get(f, boff);
+        if (!b) {
+            return sz_wrtn == 0 ? -1 : sz_wrtn;
+        }
+        if (n == BUFSIZE) {
+            // Whole block overwritten: no need to read it
+            b->valid = true;
+        }
+        int r = io61_block_load(f, b);
+        if (r >= 0
+            && b->dirty_lo != b->dirty_hi
+            && (bpos > b->dirty_hi || bpos + n < b->dirty_lo)
+            && f->mode == O_WRONLY) {
+            // Write-only blocks hold only dirty data, which must stay
+            // contiguous
+            r = io61_block_writeback(f, b);
+        }
+        if (r < 0) {
+            io61_block_put(f, b);
+            return sz_wrtn == 0 ? -1 : sz_wrtn;
+        }
+
+        if (bpos > b->len) {
+            memset(b->data + b->len, 0, bpos - b->len);
+        }
+        memcpy(b->data + bpos, buf + sz_wrtn, n);
+        f->bcache->cached_bytes += n;
+        if (bpos + n > b->len) {
+            b->len = bpos + n;
+        }
+        if (b->dirty_lo == b->dirty_hi) {
+            b->dirty_lo = bpos;
+            b->dirty_hi = bpos + n;
+        } else {
+            b->dirty_lo = bpos < b->dirty_lo ? bpos : b->dirty_lo;
+            b->dirty_hi = bpos + n > b->dirty_hi ? bpos + n : b->dirty_hi;
+        }
+        io61_block_put(f, b);
+
+        sz_wrtn += n;
+    }
+    return sz_wrtn;
+}
+
+
+// PARALLEL COPY
+
+// io61_copy_buf
+//    Transfer buffer for one `io61_copy` worker, aligned for O_DIRECT.
+
+struct io61_copy_buf {
+    alignas(DIRECT_ALIGN) unsigned char data[COPYCHUNK];
+};
+
+
+// io61_invalidate(f)
+//    Drop `f`'s cached data after its file was changed behind its back.
+//    `f` must have been flushed, and no other thread may be using it.
+
+static void io61_invalidate(io61_file* f) {
+    assert(f->dirty_tag == f->dirty_end);
+    f->tag = f->end_tag = f->pos_tag;
+    if (f->bcache) {
+        for (auto& b : f->bcache->blocks) {
+            assert(b.refs == 0 && b.dirty_lo == b.dirty_hi);
+            b.off = -1;
+            b.valid = false;
+        }
+    }
+}
+
+
+// io61_copy(outf, inf, tasks, nthreads)
+//    Copy each task's range of `inf` to `outf` using `nthreads` threads.
+//    Tasks are sorted by input offset, and adjacent tasks are merged
+//    into chunks of up to COPYCHUNK bytes. Threads take chunks in order,
+//    so that together they sweep through the input sequentially. Chunks
+//    are copied with `pread` and `pwrite`, bypassing the caches, which
+//    are flushed first; a mapped input is written straight from its
+//    mapping. Both files must be seekable and uncompressed,
+//    and no other thread may use them during the copy. Returns the
+//    number of bytes copied, or -1 on error.
+
+ssize_t io61_copy(io61_file* outf, io61_file* inf,
+                  std::vector<io61_copy_task> tasks, int nthreads) {
+    if (inf->mode == O_WRONLY || outf->mode == O_RDONLY
+        || inf->z || outf->z || nthreads <= 0
+        || io61_flush(inf) < 0 || io61_flush(outf) < 0) {
+        return -1;
+    }
+    io61_invalidate(outf);
+
+    // Sort for locality and merge adjacent tasks
+    std::sort(tasks.begin(), tasks.end(),
+              [] (const io61_copy_task& a, const io61_copy_task& b) {
+                  return a.in_off < b.in_off;
+              });
+    std::vector<io61_copy_task> chunks;
+    for (auto& t : tasks) {
+        if (!chunks.empty()) {
+            io61_copy_task& c = chunks.back();
+            if (c.in_off + off_t(c.sz) == t.in_off
+                && c.out_off + off_t(c.sz) == t.out_off
+                && c.sz + t.sz <= COPYCHUNK) {
+                c.sz += t.sz;
+                continue;
+            }
+        }
+        chunks.push_back(t);
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> ncopied{0};
+    std::atomic<unsigned long long> nreads{0}, nwrites{0};
+    std::atomic<bool> error{false};
+    auto worker = [&] () {
+        io61_copy_buf* buf = new io61_copy_buf;
+        size_t i;
+        while (!error && (i = next++) < chunks.size()) {
+            io61_copy_task c = chunks[i];
+            while (c.sz != 0) {
+                size_t n = std::min(c.sz, size_t(COPYCHUNK));
+                const unsigned char* data = buf->data;
+                ssize_t r;
+                if (inf->map && c.in_off + off_t(n) <= off_t(inf->mapsize)) {
+                    data = inf->map + c.in_off;
+                    r = n;
+                } else {
+                    r = io61_syspread(io61_fd(inf, buf->data, n, c.in_off),
+                                      buf->data, n, c.in_off);
+                    ++nreads;
+                }
+                if (r <= 0) {
+                    // Stop this task at end of file
+                    error = error || r < 0;
+                    break;
+                }
+                for (ssize_t w = 0; w != r; ) {
+                    ssize_t x = io61_syspwrite(io61_fd(outf, data + w, r - w,
+                                                       c.out_off + w),
+                                               data + w, r - w,
+                                               c.out_off + w);
+                    ++nwrites;
+                    if (x < 0) {
+                        error = true;
+                        break;
+                    }
+                    w += x;
+                }
+                ncopied += r;
+                c.in_off += r;
+                c.out_off += r;
+                c.sz -= r;
+            }
+        }
+        delete buf;
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nthreads; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    inf->stats.reads += nreads;
+    outf->stats.writes += nwrites;
+    return error ? -1 : ssize_t(ncopied);
+}
+
+
+// MEMORY MAPPING
+
+// io61_map(f, size)
+//    Map read-only regular file `f`, which has `size` bytes, into
+//    memory. The mapping becomes `f`'s cache window, so reads copy
+//    straight from the page cache and seeks need no system calls. The
+//    mapping is advised MADV_SEQUENTIAL until a seek shows otherwise
+//    (see `io61_map_advise`). Mappings of at least a huge page ask for
+//    transparent huge pages. Small files, and files not read from the
+//    start, are not mapped.
+
+static void io61_map(io61_file* f, off_t size) {
+    if (size < MMAP_MIN || lseek(f->fd, 0, SEEK_CUR) != 0) {
+        return;
+    }
+    int flags = MAP_PRIVATE;
+#ifndef MADV_POPULATE_READ
+    // Can't prefault later, so prefault now
+    if (size <= MMAP_POPULATE_MAX) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void* p = mmap(nullptr, size, PROT_READ, flags, f->fd, 0);
+    if (p == MAP_FAILED) {
+        return;
+    }
+    f->map = (unsigned char*) p;
+    f->mapsize = size;
+    f->rbuf = f->map;
+    f->end_tag = size;
+    f->map_seq = true;
+    f->map_lo = f->map_hi = 0;
+    f->map_chunk = size <= MMAP_POPULATE_MAX ? size : MMAP_CHUNK;
+    f->map_advised.assign((size + f->map_chunk - 1) / f->map_chunk, false);
+    madvise(p, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (size >= HUGEPAGE_SIZE) {
+        madvise(p, size, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+
+// io61_map_advise(f, pos)
+//    Called when a seek on mapped file `f` moves to `pos`, away from
+//    the current position and outside the chunk advised last. Seeks
+//    mean access is not sequential, so the first one drops
+//    MADV_SEQUENTIAL, whose readahead would fetch unwanted pages. Then
+//    the chunk containing `pos` is prefetched with MADV_WILLNEED and
+//    prefaulted, so that reverse, strided, and random scans take a few
+//    system calls per chunk rather than a page fault per page. Files up
+//    to MMAP_POPULATE_MAX are one chunk. (Prefaulting at `mmap` time
+//    with MAP_POPULATE would slow down sequential reads, which page
+//    faults keep up with.) Each chunk is advised at most once.
+
+static void io61_map_advise(io61_file* f, off_t pos) {
+    if (f->map_seq) {
+        madvise(f->map, f->mapsize, MADV_NORMAL);
+        f->map_seq = false;
+    }
+    size_t c = pos / f->map_chunk;
+    if (c == f->map_advised.size()) {
+        return;     // end of file
+    }
+    f->map_lo = c * f->map_chunk;
+    f->map_hi = std::min(f->map_lo + f->map_chunk, off_t(f->mapsize));
+    if (!f->map_advised[c]) {
+        f->map_advised[c] = true;
+        madvise(f->map + f->map_lo, f->map_hi - f->map_lo, MADV_WILLNEED);
+#ifdef MADV_POPULATE_READ
+        madvise(f->map + f->map_lo, f->map_hi - f->map_lo,
+                MADV_POPULATE_READ);
+#endif
+    }
+}
+
+
+// io61_unmap(f)
+//    Stop using `f`'s mapping, leaving an empty cache window at the
+//    current position. Returns 0 on success or -1 on error.
+
+static int io61_unmap(io61_file* f) {
+    munmap(f->map, f->mapsize);
+    f->map = nullptr;
+    f->rbuf = f->buf;
+    f->tag = f->end_tag = f->pos_tag;
+    ++f->stats.lseeks;
+    return lseek(f->fd, f->pos_tag, SEEK_SET) == f->pos_tag ? 0 : -1;
+}
+
+
+// COMPRESSED FRAMES
+//
+//    A compressed file is a stream of frames, each holding up to BUFSIZE
+//    uncompressed bytes, followed by an index that makes seeking cheap.
+//    Integers are stored in host byte order.
+//
+//    file   := "io61z\0\0\1" frame* end index
+//    frame  := u32 clen, u32 ulen, data[clen & ~ZRAW]
+//    end    := u32 0, u32 0
+//    index  := (u64 uoff, u64 coff)*, u64 usize, u64 nframes, "io61zidx"
+//
+//    If `clen & ZRAW`, the frame data is stored uncompressed. Otherwise
+//    it is LZ77-compressed as a sequence of LZ4-style "sequences": a
+//    token byte whose high nibble is the literal length and low nibble
+//    is the match length minus 4 (15 means more length bytes follow,
+//    each added until one is not 255), the literals, and a 2-byte
+//    little-endian match offset. The last sequence has literals only.
+//    Readers of pipes stop at the end marker; seeking reads the index.
+
+#define ZRAW 0x80000000U
+static const char io61_zmagic[] = "io61z\0\0\1";
+static const char io61_zidxmagic[] = "io61zidx";
+
+
+// io61_lz_putlen(p, len)
+//    Write the extra length bytes for length `len` >= 15 at `p`.
+//    Returns the next output position.
+
+static unsigned char* io61_lz_putlen(unsigned char* p, size_t len) {
+    for (len -= 15; len >= 255; len -= 255) {
+        *p++ = 255;
+    }
+    *p++ = len;
+    return p;
+}
+
+
+// io61_lz_compress(dst, src, n, table)
+//    Compress `n` bytes from `src` into `dst`, which must have room for
+//    `n + n / 255 + 16` bytes. `table` is scratch space for the match
+//    finder. Returns the compressed size.
+
+static size_t io61_lz_compress(unsigned char* dst, const unsigned char* src,
+                               size_t n, uint32_t* table) {
+    memset(table, 0, sizeof(uint32_t) << ZHASHBITS);
+    unsigned char* op = dst;
+    size_t ip = 0, anchor = 0;
+    while (n >= 4 && ip <= n - 4) {
+        uint32_t seq, mseq;
+        memcpy(&seq, src + ip, 4);
+        uint32_t h = (seq * 2654435761U) >> (32 - ZHASHBITS);
+        size_t m = table[h];    // candidate match position plus 1
+        table[h] = ip + 1;
+        if (m == 0 || ip + 1 - m > 65535
+            || (memcpy(&mseq, src + m - 1, 4), mseq != seq)) {
+            // No match; skip faster through incompressible data
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+        --m;
+        size_t mlen = 4;
+        while (ip + mlen < n && src[m + mlen] == src[ip + mlen]) {
+            ++mlen;
+        }
+
+        size_t lit = ip - anchor;
+        *op++ = (std::min(lit, size_t(15)) << 4)
+            | std::min(mlen - 4, size_t(15));
+        if (lit >= 15) {
+            op = io61_lz_putlen(op, lit);
+        }
+        memcpy(op, src + anchor, lit);
+        op += lit;
+        *op++ = (ip - m) & 0xFF;
+        *op++ = (ip - m) >> 8;
+        if (mlen - 4 >= 15) {
+            op = io61_lz_putlen(op, mlen - 4);
+        }
+        ip += mlen;
+        anchor = ip;
+    }
+
+    // Last sequence: remaining literals
+    size_t lit = n - anchor;
+    *op++ = std::min(lit, size_t(15)) << 4;
+    if (lit >= 15) {
+        op = io61_lz_putlen(op, lit);
+    }
+    memcpy(op, src + anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+
+// io61_lz_decompress(dst, cap, src, n)
+//    Decompress `n` bytes from `src` into `dst`, which has room for
+//    `cap` bytes. Returns the decompressed size, or -1 if the data is
+//    corrupt.
+
+static ssize_t io61_lz_decompress(unsigned char* dst, size_t cap,
+                                  const unsigned char* src, size_t n) {
+    size_t ip = 0, op = 0;
+    while (ip < n) {
+        unsigned token = src[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip == n) {
+                    return -1;
+                }
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (lit > n - ip || lit > cap - op) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == n) {
+            break;
+        }
+
+        if (n - ip < 2) {
+            return -1;
+        }
+        size_t moff = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        size_t mlen = (token & 15) + 4;
+        if ((token & 15) == 15) {
+            unsigned b;
+            do {
+                if (ip == n) {
+                    return -1;
+                }
+                b = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        if (moff == 0 || moff > op || mlen > cap - op) {
+            return -1;
+        }
+        if (moff >= mlen) {
+            memcpy(dst + op, dst + op - moff, mlen);
+        } else {
+            // Overlapping match repeats a short pattern
+            for (size_t i = 0; i != mlen; ++i) {
+                dst[op + i] = dst[op + i - moff];
+            }
+        }
+        op += mlen;
+    }
+    return op;
+}
+
+
+// io61_zneed(f, n)
+//    Make at least `n` unread compressed bytes available in `f->z->raw`,
+//    reading more if necessary. Returns the number available, which is
+//    less than `n` only at end-of-file or on error.
+
+static size_t io61_zneed(io61_file* f, size_t n) {
+    io61_zstate* z = f->z;
+    assert(n <= ZBUFSIZE);
+    if (z->rlen - z->rpos >= n) {
+        return n;
+    }
+    memmove(z->raw, z->raw + z->rpos, z->rlen - z->rpos);
+    z->rlen -= z->rpos;
+    z->rpos = 0;
+    while (z->rlen < n) {
+        if (f->interactive) {
+            io61_before_block(f);
+        }
+        ssize_t r = io61_sysread(f->fd, z->raw + z->rlen, ZBUFSIZE - z->rlen);
+        ++f->stats.reads;
+        if (r <= 0) {
+            break;
+        }
+        z->rlen += r;
+    }
+    return z->rlen;
+}
+
+
+// io61_zfill(f)
+//    Decompress the next frame of `f` into its cache, at `f->end_tag`.
+//    Returns the number of bytes decompressed, which is 0 at the end of
+//    the stream, or -1 on error or corrupt data.
+
+static ssize_t io61_zfill(io61_file* f) {
+    io61_zstate* z = f->z;
+    if (!z->started) {
+        if (io61_zneed(f, 8) < 8 || memcmp(z->raw, io61_zmagic, 8) != 0) {
+            return -1;
+        }
+        z->rpos += 8;
+        z->started = true;
+    }
+    if (z->eof) {
+        return 0;
+    }
+
+    uint32_t hdr[2];
+    if (io61_zneed(f, 8) < 8) {
+        return -1;
+    }
+    memcpy(hdr, z->raw + z->rpos, 8);
+    if (hdr[0] == 0 && hdr[1] == 0) {
+        z->eof = true;
+        return 0;
+    }
+    size_t clen = hdr[0] & ~ZRAW;
+    if (clen > ZBUFSIZE - 8 || hdr[1] > BUFSIZE
+        || io61_zneed(f, 8 + clen) < 8 + clen) {
+        return -1;
+    }
+    const unsigned char* data = z->raw + z->rpos + 8;
+    z->rpos += 8 + clen;
+    if (hdr[0] & ZRAW) {
+        if (clen != hdr[1]) {
+            return -1;
+        }
+        memcpy(f->buf, data, clen);
+        return clen;
+    }
+    ssize_t r = io61_lz_decompress(f->buf, BUFSIZE, data, clen);
+    return r == ssize_t(hdr[1]) ? r : -1;
+}
+
+
+// io61_zwrite(f, p, sz)
+//    Write `sz` bytes at `p` to `f`'s file descriptor, looping on short
+//    writes. Returns 0 on success or -1 on error.
+
+static int io61_zwrite(io61_file* f, const unsigned char* p, size_t sz) {
+    while (sz != 0) {
+        ssize_t w = io61_syswrite(f->fd, p, sz);
+        ++f->stats.writes;
+        if (w < 0) {
+            return -1;
+        }
+        p += w;
+        sz -= w;
+        f->z->coff += w;
+    }
+    return 0;
+}
+
+
+// io61_zflush(f)
+//    Compress `f`'s dirty range as one frame and write it. Writes to
+//    compressed files are sequential, so the dirty range is the whole
+//    cache. Returns 0 on success or -1 on error.
+
+static int io61_zflush(io61_file* f) {
+    io61_zstate* z = f->z;
+    assert(f->dirty_tag == f->tag);
+    size_t n = f->dirty_end - f->dirty_tag;
+    size_t hpos = 0;
+    if (!z->started) {
+        memcpy(z->raw, io61_zmagic, 8);
+        hpos = 8;
+    }
+
+    unsigned char* data = z->raw + hpos + 8;
+    uint32_t hdr[2] = {0, uint32_t(n)};
+    hdr[0] = io61_lz_compress(data, f->buf, n, z->table);
+    if (hdr[0] >= n) {
+        // Incompressible: store instead
+        memcpy(data, f->buf, n);
+        hdr[0] = n | ZRAW;
+    }
+    memcpy(z->raw + hpos, hdr, 8);
+
+    if (io61_zwrite(f, z->raw, hpos + 8 + (hdr[0] & ~ZRAW)) < 0) {
+        return -1;
+    }
+    z->started = true;
+    z->index.push_back({f->dirty_tag, z->coff - off_t(8 + (hdr[0] & ~ZRAW))});
+    f->dirty_tag = f->dirty_end;
+    return 0;
+}
+
+
+// io61_zfinish(f)
+//    Write the end marker and index of compressed write-only file `f`.
+//    Returns 0 on success or -1 on error.
+
+static int io61_zfinish(io61_file* f) {
+    io61_zstate* z = f->z;
+    if (!z->started) {
+        if (io61_zwrite(f, (const unsigned char*) io61_zmagic, 8) < 0) {
+            return -1;
+        }
+        z->started = true;
+    }
+    uint64_t trailer[2] = {uint64_t(f->pos_tag), z->index.size()};
+    const uint32_t end[2] = {0, 0};
+    if (io61_zwrite(f, (const unsigned char*) end, sizeof(end)) < 0
+        || io61_zwrite(f, (const unsigned char*) z->index.data(),
+                       z->index.size() * sizeof(io61_zentry)) < 0
+        || io61_zwrite(f, (const unsigned char*) trailer,
+                       sizeof(trailer)) < 0
+        || io61_zwrite(f, (const unsigned char*) io61_zidxmagic, 8) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+
+// io61_zpread(f, p, sz, off)
+//    Read exactly `sz` bytes of `f`'s file at offset `off` into `p`,
+//    looping on short reads. Returns 0 on success or -1 on error or
+//    early end-of-file.
+
+static int io61_zpread(io61_file* f, void* p, size_t sz, off_t off) {
+    while (sz != 0) {
+        ssize_t r = io61_syspread(f->fd, p, sz, off);
+        ++f->stats.reads;
+        if (r <= 0) {
+            return -1;
+        }
+        p = (char*) p + r;
+        sz -= r;
+        off += r;
+    }
+    return 0;
+}
+
+
+// io61_zindex(f)
+//    Load the index of compressed read-only file `f`, which must be a
+//    regular file. Returns 0 on success or -1 on error.
+
+static int io61_zindex(io61_file* f) {
+    io61_zstate* z = f->z;
+    if (z->indexed) {
+        return 0;
+    }
+    struct stat s;
+    unsigned char tail[24];
+    if (fstat(f->fd, &s) < 0
+        || !S_ISREG(s.st_mode)
+        || s.st_size < 40
+        || io61_zpread(f, tail, 24, s.st_size - 24) < 0
+        || memcmp(tail + 16, io61_zidxmagic, 8) != 0) {
+        return -1;
+    }
+    uint64_t trailer[2];
+    memcpy(trailer, tail, 16);
+    size_t isz = trailer[1] * sizeof(io61_zentry);
+    if (trailer[1] > uint64_t(s.st_size) / sizeof(io61_zentry)
+        || s.st_size < off_t(isz + 40)) {
+        return -1;
+    }
+    z->index.resize(trailer[1]);
+    if (io61_zpread(f, z->index.data(), isz, s.st_size - 24 - isz) < 0) {
+        return -1;
+    }
+    z->usize = trailer[0];
+    z->cend = s.st_size - 24 - isz - 8;
+    z->indexed = true;
+    return 0;
+}
+
+
+// io61_zseek(f, pos)
+//    Seek compressed file `f` to uncompressed offset `pos`. Write-only
+//    files cannot seek. Read-only files use the index to find the
+//    frame containing `pos`. Returns 0 on success and -1 on failure.
+
+static int io61_zseek(io61_file* f, off_t pos) {
+    io61_zstate* z = f->z;
+    if (f->mode == O_WRONLY) {
+        return pos == f->pos_tag ? 0 : -1;
+    }
+    if (pos >= f->tag && pos < f->end_tag) {
+        f->pos_tag = pos;
+        return 0;
+    }
+    if (io61_zindex(f) < 0) {
+        return -1;
+    }
+
+    // Find last frame starting at or before `pos`
+    auto it = std::upper_bound(z->index.begin(), z->index.end(), pos,
+        [] (off_t p, const io61_zentry& e) { return p < e.uoff; });
+    off_t coff = z->cend, uoff = pos;
+    if (it != z->index.begin() && pos < z->usize) {
+        --it;
+        coff = it->coff;
+        uoff = it->uoff;
+    }
+    ++f->stats.lseeks;
+    if (lseek(f->fd, coff, SEEK_SET) != coff) {
+        return -1;
+    }
+    z->rpos = z->rlen = 0;
+    z->started = true;
+    z->eof = false;
+    f->tag = f->pos_tag = f->end_tag = uoff;
+    if (uoff != pos) {
+        if (io61_fill(f) < 0 || pos >= f->end_tag) {
+            return -1;
+        }
+    }
+    f->pos_tag = pos;
+    return 0;
+}
+
+
+// You shouldn't need to change these functions.
+
+// io61_open_check(filename, mode)
+//    Open the file corresponding to `filename` and return its io61_file.
+//    If `!filename`, returns either the standard input or the
+//    standard output, depending on `mode`. Exits with an error message if
+//    `filename != nullptr` and the named file cannot be opened.
+
+io61_file* io61_open_check(const char* filename, int mode) {
+    int fd;
+    if (filename) {
+        fd = open(filename, mode & ~IO61_COMPRESSED, 0666);
+        if (fd < 0 && errno == EINVAL && (mode & O_DIRECT)) {
+            // File system does not support O_DIRECT
+            fd = open(filename, mode & ~(O_DIRECT | IO61_COMPRESSED), 0666);
+        }
+    } else if ((mode & O_ACCMODE) == O_RDONLY) {
+        fd = STDIN_FILENO;
+    } else {
+        fd = STDOUT_FILENO;
+    }
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    return io61_fdopen(fd, mode & (O_ACCMODE | IO61_COMPRESSED));
+}
+
+
+// io61_filesize(f)
+//    Return the size of `f` in bytes. Returns -1 if `f` does not have a
+//    well-defined size (for instance, if it is a pipe).
+
+off_t io61_filesize(io61_file* f) {
+    if (f->z) {
+        // Uncompressed size is recorded in the index
+        if (f->mode == O_RDONLY && io61_zindex(f) >= 0) {
+            return f->z->usize;
+        }
+        return -1;
+    }
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r >= 0 && S_ISREG(s.st_mode)) {
@@ -10,6 +10,12 @@
 
 struct io61_file;
 
+// IO61_COMPRESSED
+//    Mode flag for `io61_fdopen` and `io61_open_check`: the file is a
+//    stream of compressed frames. Read-only files decompress as they
+//    read, and write-only files compress as they write.
+#define IO61_COMPRESSED 0x40000000
+
 io61_file* io61_fdopen(int fd, int mode);
 io61_file* io61_open_check(const char* filename, int mode);
 int io61_close(io61_file* f);
@@ -24,17 +30,61 @@ int io61_writec(io61_file* f, int ch);
 ssize_t io61_read(io61_file* f, char* buf, size_t sz);
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz);
 
+ssize_t io61_readline(io61_file* f, const char** line);
+ssize_t io61_getline(io61_file* f, char* buf, size_t sz);
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off);
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off);
+
+// io61_copy_task
+//    One range for `io61_copy` to copy.
+struct io61_copy_task {
+    off_t in_off;               // offset in input file
+    off_t out_off;              // offset in output file
+    size_t sz;                  // number of bytes
+};
+
+ssize_t io61_copy(io61_file* outf, io61_file* inf,
+                  std::vector<io61_copy_task> tasks, int nthreads);
+
 int io61_flush(io61_file* f);
 
 void io61_profile_begin();
 void io61_profile_end();
 
 
+// io61_stats
+//    I/O statistics. Each io61_file counts its own and adds them to
+//    `io61_stats_total` when closed; `io61_profile_end` reports the
+//    totals. Backends that cannot observe system calls count nothing.
+
+struct io61_stats {
+    unsigned long long files;         // number of closed files counted
+    unsigned long long cached_bytes;  // bytes read from or written to cache
+    unsigned long long refills;       // cache refills
+    unsigned long long reads;         // `read` and `pread` system calls
+    unsigned long long writes;        // `write` and `pwrite` system calls
+    unsigned long long lseeks;        // `lseek` system calls
+    unsigned long long seek_distance; // total distance moved by `io61_seek`
+    unsigned long long flushes;       // nonempty cache flushes
+    unsigned long long flush_bytes;   // bytes written by those flushes
+
+    void add(const io61_stats& x);
+};
+
+extern io61_stats io61_stats_total;
+
+
 struct io61_arguments {
     size_t input_size;          // `-s` option: input size. Default SIZE_MAX
     size_t block_size;          // `-b` option: block size. Default 0
     size_t stride;              // `-t` option: stride. Default 1024
     bool lines;                 // `-l` option: read by lines. Default false
+    bool direct;                // `-D` option: use O_DIRECT. Default false
+    bool compress;              // `-z` option: compress output. Default false
+    bool decompress;            // `-Z` option: decompress input. Default false
+    bool positional;            // `-p` option: positional I/O. Default false
+    int nthreads;               // `-j` option: number of threads. Default 0
     const char* output_file;    // `-o` option: output file. Default nullptr
     const char* input_file;     // input file. Default nullptr
     std::vector<const char*> input_files;   // all input files
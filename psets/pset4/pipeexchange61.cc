@@ -119,10 +119,12 @@ int main(int argc, char* argv[]) {
     (void) argc, (void) argv;
 
     // create a connected socket pair for communicating between processes
+    // (pipes are too small to hold a batch of requests or replies)
     int request_fds[2], response_fds[2];
-    int r1 = pipe(request_fds), r2 = pipe(response_fds);
+    int r1 = socketpair(AF_UNIX, SOCK_STREAM, 0, request_fds);
+    int r2 = socketpair(AF_UNIX, SOCK_STREAM, 0, response_fds);
     if (r1 < 0 || r2 < 0) {
-        perror("pipe");
+        perror("socketpair");
         exit(1);
     }
 
@@ -6,10 +6,24 @@
 // profile61.c
 //    The profile functions measure how much time and memory are used
 //    by your code. The io61_profile_end() function prints a simple
-//    report to standard error. The io61_parse_arguments() function
+//    report to standard error, including the I/O statistics gathered
+//    from closed io61_files. The io61_parse_arguments() function
 //    parses common arguments into a structure.
 
 static struct timeval tv_begin;
+io61_stats io61_stats_total;
+
+void io61_stats::add(const io61_stats& x) {
+    files += x.files;
+    cached_bytes += x.cached_bytes;
+    refills += x.refills;
+    reads += x.reads;
+    writes += x.writes;
+    lseeks += x.lseeks;
+    seek_distance += x.seek_distance;
+    flushes += x.flushes;
+    flush_bytes += x.flush_bytes;
+}
 
 void io61_profile_begin() {
     int r = gettimeofday(&tv_begin, 0);
@@ -32,11 +46,19 @@ void io61_profile_end() {
     timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
 
     char buf[1000];
-    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld",
                       tv_end.tv_sec, (long) tv_end.tv_usec,
                       usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
                       usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
                       usage.ru_maxrss + cusage.ru_maxrss);
+    const io61_stats& st = io61_stats_total;
+    if (st.files) {
+        len += sprintf(buf + len, ", \"cached_bytes\":%llu, \"refills\":%llu, \"reads\":%llu, \"writes\":%llu, \"lseeks\":%llu, \"seek_distance\":%llu, \"flushes\":%llu, \"flush_bytes\":%llu",
+                       st.cached_bytes, st.refills, st.reads, st.writes,
+                       st.lseeks, st.seek_distance, st.flushes,
+                       st.flush_bytes);
+    }
+    len += sprintf(buf + len, "}\n");
 
     // Print the report to file descriptor 100 if it's available. Our
     // `check.pl` test harness uses this file descriptor.
@@ -55,6 +77,10 @@ io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
     block_size = 0;
     stride = 1024;
     lines = false;
+    direct = false;
+    compress = decompress = false;
+    positional = false;
+    nthreads = 0;
     output_file = input_file = nullptr;
     opts = opts_;
     program_name = argv[0];
@@ -84,6 +110,24 @@ io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
         case 'l':
             lines = true;
             break;
+        case 'j':
+            nthreads = (int) strtol(optarg, &endptr, 0);
+            if (nthreads <= 0 || endptr == optarg || *endptr) {
+                goto usage;
+            }
+            break;
+        case 'D':
+            direct = true;
+            break;
+        case 'z':
+            compress = true;
+            break;
+        case 'Z':
+            decompress = true;
+            break;
+        case 'p':
+            positional = true;
+            break;
         case 'r': {
             unsigned long seed = strtoul(optarg, &endptr, 0);
             if (endptr == optarg || *endptr) {
@@ -142,6 +186,21 @@ void io61_arguments::usage() {
     if (strchr(opts, 'l')) {
         fprintf(stderr, " [-l]");
     }
+    if (strchr(opts, 'j')) {
+        fprintf(stderr, " [-j THREADS]");
+    }
+    if (strchr(opts, 'D')) {
+        fprintf(stderr, " [-D]");
+    }
+    if (strchr(opts, 'z')) {
+        fprintf(stderr, " [-z]");
+    }
+    if (strchr(opts, 'Z')) {
+        fprintf(stderr, " [-Z]");
+    }
+    if (strchr(opts, 'p')) {
+        fprintf(stderr, " [-p]");
+    }
     if (strchr(opts, 'o')) {
         fprintf(stderr, " [-o OUTFILE]");
     }
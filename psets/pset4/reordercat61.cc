@@ -1,15 +1,17 @@
 #include "io61.hh"
 
 // Usage: ./reordercat61 [-b BLOCKSIZE] [-r RANDOMSEED] [-s SIZE]
-//                       [-o OUTFILE] [FILE]
+//                       [-j THREADS] [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE in blocks. The blocks are
 //    transferred in random order, but the resulting output file
 //    should be the same as the input. Default BLOCKSIZE is 4096.
+//    With `-j`, the blocks are handed to `io61_copy` in random order
+//    and copied by THREADS threads.
 
 int main(int argc, char* argv[]) {
     // Parse arguments
     srandom(83419);
-    io61_arguments args(argc, argv, "b:r:s:o:i:");
+    io61_arguments args(argc, argv, "b:r:s:j:o:i:");
     size_t block_size = args.block_size ? args.block_size : 4096;
 
     // Allocate buffer, open files, measure file sizes
@@ -53,6 +55,20 @@ int main(int argc, char* argv[]) {
     }
 
     // Copy file data
+    if (args.nthreads) {
+        std::vector<io61_copy_task> tasks;
+        while (nblocks != 0) {
+            size_t index = random() % nblocks;
+            size_t pos = blockpos[index] * block_size;
+            blockpos[index] = blockpos[nblocks - 1];
+            --nblocks;
+            tasks.push_back({(off_t) pos, (off_t) pos, block_size});
+        }
+        if (io61_copy(outf, inf, std::move(tasks), args.nthreads) < 0) {
+            fprintf(stderr, "reordercat61: copy failed\n");
+            exit(1);
+        }
+    }
     while (nblocks != 0) {
         // Choose block to read
         size_t index = random() % nblocks;
@@ -1,16 +1,18 @@
 #include "io61.hh"
 
-// Usage: ./reverse61 [-s SIZE] [-o OUTFILE] [FILE]
+// Usage: ./reverse61 [-s SIZE] [-Z] [-o OUTFILE] [FILE]
 //    Copies the input FILE to OUTFILE one character at a time,
-//    reversing the order of characters in the input.
+//    reversing the order of characters in the input. With `-Z`, FILE
+//    is compressed (see `blockcat61 -z`).
 
 int main(int argc, char* argv[]) {
     // Parse arguments
-    io61_arguments args(argc, argv, "s:o:i:");
+    io61_arguments args(argc, argv, "s:Zo:i:");
 
     // Open files, measure file sizes
     io61_profile_begin();
-    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY
+                                     | (args.decompress ? IO61_COMPRESSED : 0));
     io61_file* outf = io61_open_check(args.output_file,
                                       O_WRONLY | O_CREAT | O_TRUNC);
 
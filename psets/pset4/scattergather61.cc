@@ -12,19 +12,7 @@
 
 ssize_t read_line(io61_file* f, char* buf, size_t sz, bool lines) {
     if (lines) {
-        size_t i = 0;
-        while (i != sz) {
-            int ch = io61_readc(f);
-            if (ch == EOF) {
-                break;
-            }
-            buf[i] = ch;
-            ++i;
-            if (ch == '\n') {
-                break;
-            }
-        }
-        return i;
+        return io61_getline(f, buf, sz);
     } else {
         return io61_read(f, buf, sz);
     }
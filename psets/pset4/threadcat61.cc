@@ -0,0 +1,63 @@
+#include "io61.hh"
+#include <thread>
+
+// Usage: ./threadcat61 [-b BLOCKSIZE] [-s SIZE] [-j THREADS] [-o OUTFILE]
+//                      [FILE]
+//    Copies the input FILE to OUTFILE in blocks using THREADS threads
+//    that share both files. Thread I copies blocks I, I+THREADS, ...
+//    with `io61_pread` and `io61_pwrite`. Default BLOCKSIZE is 4096;
+//    default THREADS is 4.
+
+static void copy_blocks(io61_file* inf, io61_file* outf, size_t size,
+                        size_t block_size, int index, int nthreads) {
+    char* buf = new char[block_size];
+    for (size_t pos = index * block_size; pos < size;
+         pos += nthreads * block_size) {
+        ssize_t amount = io61_pread(inf, buf, block_size, pos);
+        if (amount <= 0) {
+            break;
+        }
+        io61_pwrite(outf, buf, amount, pos);
+    }
+    delete[] buf;
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:s:j:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+    int nthreads = args.nthreads ? args.nthreads : 4;
+
+    // Open files, measure file sizes
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+
+    if ((ssize_t) args.input_size < 0) {
+        args.input_size = io61_filesize(inf);
+    }
+    if ((ssize_t) args.input_size < 0) {
+        fprintf(stderr, "threadcat61: can't get size of input file\n");
+        exit(1);
+    }
+
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    if (io61_seek(outf, 0) < 0) {
+        fprintf(stderr, "threadcat61: output file is not seekable\n");
+        exit(1);
+    }
+
+    // Copy file data
+    std::vector<std::thread> threads;
+    for (int i = 0; i != nthreads; ++i) {
+        threads.emplace_back(copy_blocks, inf, outf, args.input_size,
+                             block_size, i, nthreads);
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
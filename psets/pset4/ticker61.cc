@@ -0,0 +1,97 @@
+#include "io61.hh"
+#include <ctime>
+#include <sys/wait.h>
+
+// Usage: ./ticker61 [-s NLINES] [-o OUTFILE]
+//    Writes NLINES short lines (default 24) into a pipe in groups of
+//    BURST. The lines of a group are written 10us apart, except the
+//    last, which follows 1ms later: that is longer than the coalescing
+//    delay, so it must send the whole group. Each group is followed by
+//    a PAUSE_US pause without io61 calls. Even groups are written with
+//    `io61_write`, odd groups with `io61_writec`. A child process reads
+//    the lines with `io61_readline` and checks that each arrives within
+//    LATE_MS of being written; it copies the line numbers to OUTFILE.
+//    Late lines are reported on standard error and make the program
+//    exit with status 1.
+
+#define BURST 4
+#define PAUSE_US 100000
+#define LATE_MS 25
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void reader(io61_file* inf, io61_file* outf) {
+    bool late = false;
+    const char* line;
+    while (io61_readline(inf, &line) > 0) {
+        unsigned long long arrival = now_ns();
+        size_t lineno;
+        unsigned long long sent;
+        int r = sscanf(line, "%zu %llu", &lineno, &sent);
+        assert(r == 2);
+        if (arrival - sent > LATE_MS * 1000000ULL) {
+            fprintf(stderr, "ticker61: line %zu arrived %.1fms after "
+                    "it was written\n", lineno,
+                    (arrival - sent) / 1000000.0);
+            late = true;
+        }
+        char out[32];
+        int len = snprintf(out, sizeof(out), "%zu\n", lineno);
+        io61_write(outf, out, len);
+    }
+    io61_close(inf);
+    io61_close(outf);
+    exit(late ? 1 : 0);
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "s:o:");
+    size_t nlines = args.input_size != (size_t) -1 ? args.input_size : 24;
+
+    io61_profile_begin();
+    int pipefd[2];
+    int r = pipe(pipefd);
+    assert(r == 0);
+
+    pid_t p = fork();
+    assert(p >= 0);
+    if (p == 0) {
+        close(pipefd[1]);
+        reader(io61_fdopen(pipefd[0], O_RDONLY),
+               io61_open_check(args.output_file,
+                               O_WRONLY | O_CREAT | O_TRUNC));
+    }
+    close(pipefd[0]);
+
+    io61_file* pipef = io61_fdopen(pipefd[1], O_WRONLY);
+    for (size_t i = 0; i != nlines; ++i) {
+        if (i % BURST == BURST - 1) {
+            usleep(1000);
+        } else if (i % BURST != 0) {
+            usleep(10);
+        }
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%zu %llu\n", i, now_ns());
+        if ((i / BURST) % 2 == 0) {
+            io61_write(pipef, line, len);
+        } else {
+            for (int j = 0; j != len; ++j) {
+                io61_writec(pipef, line[j]);
+            }
+        }
+        if (i % BURST == BURST - 1) {
+            usleep(PAUSE_US);
+        }
+    }
+    io61_close(pipef);
+
+    int status;
+    waitpid(p, &status, 0);
+    io61_profile_end();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
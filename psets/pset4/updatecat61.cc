@@ -0,0 +1,77 @@
+#include "io61.hh"
+#include <cctype>
+
+// Usage: ./updatecat61 [-b BLOCKSIZE] [-s SIZE] [-p] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE in blocks, then updates OUTFILE
+//    in place through the same read/write file: every block, starting
+//    from the last, is read back, converted to upper case, and
+//    rewritten at the same position. Default BLOCKSIZE is 4096. With
+//    `-p`, every other block, starting with the last, is updated with
+//    `io61_pread` and `io61_pwrite`, mixing sequential and positional
+//    I/O on one file.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:s:po:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_RDWR | O_CREAT | O_TRUNC);
+    if (io61_seek(outf, 0) < 0) {
+        fprintf(stderr, "updatecat61: output file is not seekable\n");
+        exit(1);
+    }
+
+    // Copy file data
+    size_t size = 0;
+    while (size < args.input_size) {
+        size_t want = block_size;
+        if (want > args.input_size - size) {
+            want = args.input_size - size;
+        }
+        ssize_t amount = io61_read(inf, buf, want);
+        if (amount <= 0) {
+            break;
+        }
+        io61_write(outf, buf, amount);
+        size += amount;
+    }
+
+    // Update blocks in place, last block first
+    size_t end = size;
+    bool positional = args.positional;
+    while (end != 0) {
+        size_t pos = (end - 1) - (end - 1) % block_size;
+        ssize_t amount;
+        if (positional) {
+            amount = io61_pread(outf, buf, end - pos, pos);
+        } else {
+            int r = io61_seek(outf, pos);
+            assert(r >= 0);
+            amount = io61_read(outf, buf, end - pos);
+        }
+        assert(amount == (ssize_t) (end - pos));
+        for (ssize_t i = 0; i != amount; ++i) {
+            buf[i] = toupper((unsigned char) buf[i]);
+        }
+        if (positional) {
+            io61_pwrite(outf, buf, amount, pos);
+        } else {
+            int r = io61_seek(outf, pos);
+            assert(r >= 0);
+            io61_write(outf, buf, amount);
+        }
+        positional = args.positional && !positional;
+        end = pos;
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+}
@@ -74,6 +74,12 @@ sub CMD_MAX_TIME ()       { "CMD_MAX_TIME" }
       "echo Line 1\necho Line 2\necho Line 3",
       'Line 1 Line 2 Line 3' ],
 
+    [ 'Test SIMPLE5',
+      './script61 One ; ( ./script61 Two ) ; export PATH=.:/usr/bin:/bin ; script61 Three',
+      'Script One Script Two Script Three',
+      CMD_INIT => 'echo "echo Script \$1" > script61 ; chmod +x script61',
+      CMD_CLEANUP => 'rm -f script61' ],
+
 
 # Background commands
     [ 'Test BG1',
@@ -94,6 +100,11 @@ sub CMD_MAX_TIME ()       { "CMD_MAX_TIME" }
       CMD_INIT => 'echo Still here > f%%a.txt; echo > f%%b.txt',
       CMD_CLEANUP => 'rm f%%b.txt && sleep 0.3 && cat f%%a.txt' ],
 
+    # The last command of a background subshell replaces the subshell
+    [ 'Test BG4',
+      "(true ; sleep 0.3) & sleep 0.1 ; ps t $TTY -o stat=,comm= | grep -v ^Z | grep -c sh61",
+      '1' ],
+
 
 # Command lists
     [ 'Test LIST1',
@@ -309,6 +320,25 @@ sub CMD_MAX_TIME ()       { "CMD_MAX_TIME" }
       'First Second',
       CMD_CLEANUP => 'sleep 0.25'],
 
+    [ 'Test PIPE26',
+      'false | true && echo Last ; set -o pipefail ; false | true || echo Any ; true | true && echo Ok',
+      'Last Any Ok' ],
+
+    [ 'Test PIPE27',
+      'set -o pipestats ; sleep 0.1 | false | true ; echo Done',
+      'status 0 sleep 0.1 status 1 false status 0 true Done',
+      CMD_OUTPUT_FILTER => 'grep -o "status.*\\|Done"' ],
+
+    [ 'Test PIPE28',
+      'time echo Hello | tr a-z A-Z ; echo Done',
+      'HELLO Timed Done',
+      CMD_OUTPUT_FILTER => 'sed "s/^real [0-9.]*s .* csw [0-9]*+[0-9]*$/Timed/"' ],
+
+    [ 'Test PIPE29',
+      'time -j sleep 0.1 | cat',
+      'Json 0.1',
+      CMD_OUTPUT_FILTER => 'sed -n "s/^{\"time\":\(0\.1\)[0-9]*, \"utime\".*\"nivcsw\":[0-9]*}$/Json \1/p"' ],
+
 
 # Zombies
     [ 'Test ZOMBIE1',
@@ -415,6 +445,28 @@ sub CMD_MAX_TIME ()       { "CMD_MAX_TIME" }
       'echo the redirection > out.txt can really occur anywhere && cat out.txt',
       'the redirection can really occur anywhere' ],
 
+    [ 'Test REDIR19',
+      'echo Hello > in.txt ; cat /dev/fd/5 5< in.txt | tr a-z A-Z',
+      'HELLO' ],
+
+    [ 'Test REDIR20',
+      'nonexistent%% < in.txt || echo Wanted',
+      'No such file or directory Wanted',
+      CMD_INIT => 'echo Hello > in.txt',
+      CMD_CLEANUP => 'perl -pi -e "s,^.*:\s*,," out%%.txt' ],
+
+    [ 'Test REDIR21',
+      'echo 1 2 3 4 5 6 7 8 9 10 11 12 > out1.txt > out2.txt ; cat out1.txt out2.txt',
+      '1 2 3 4 5 6 7 8 9 10 11 12' ],
+
+    [ 'Test REDIR22',
+      "cat <<EOF | tr a-z A-Z\nfirst\nsecond\nEOF\ncat <<- END ; echo After\n\tTabbed\n\tEND",
+      'FIRST SECOND Tabbed After' ],
+
+    [ 'Test REDIR23',
+      'tr a-z A-Z <<< "here string" ; wc -c <<< hello',
+      'HERE STRING 6' ],
+
 
 # cd
     [ 'Test CD1',
@@ -452,6 +504,82 @@ sub CMD_MAX_TIME ()       { "CMD_MAX_TIME" }
       '/' ],
 
 
+# Builtins run in the shell
+    [ 'Test BUILTIN1',
+      'echo One > out.txt ; echo Two ; cat out.txt',
+      'Two One' ],
+
+    [ 'Test BUILTIN2',
+      'export SH61VAR=Exported ; sh -c "echo \\$SH61VAR" ; unset SH61VAR ; sh -c "echo Unset\\$SH61VAR"',
+      'Exported Unset' ],
+
+    [ 'Test BUILTIN3',
+      'cd / | true ; cd /tmp && echo -n Here | cat && pwd ; exit 0 ; echo Unwanted',
+      'Here/tmp' ],
+
+    [ 'Test BUILTIN4',
+      'export PATH=/usr/bin:/bin ; hash echo61 2> /dev/null || echo Missing ; echo "#!/bin/sh" > echo61 ; echo "echo Found" >> echo61 ; chmod +x echo61 ; export PATH=.:/usr/bin:/bin ; echo61 ; hash cat ; hash',
+      'Missing Found cat /usr/bin/cat',
+      CMD_CLEANUP => 'rm -f echo61' ],
+
+
+# Job control
+    [ 'Test JOB1',
+      'sleep 0.2 & sleep 0.1 ; jobs ; wait ; jobs ; echo Waited',
+      'Running sleep 0.2 Waited' ],
+
+    [ 'Test JOB2',
+      '( sleep 0.1 ; false ) & wait %1 || echo Failed',
+      'Failed' ],
+
+    [ 'Test JOB3',
+      'false & echo Bye > out.txt && true & sleep 0.1 ; jobs ; cat out.txt',
+      'Exit 1 false Done echo Bye > out.txt && true Bye' ],
+
+
+    [ 'Test PARALLEL1',
+      'parallel -j 3 -k sh -c "sleep 0.0{} ; echo {}" ::: 3 1 2 4',
+      '3 1 2 4' ],
+
+    [ 'Test PARALLEL2',
+      'parallel -j 4 sleep ::: 0.2 0.2 0.2 0.2 && parallel -j 2 sh -c "exit {}" ::: 0 3 0 2> out.txt || cat out.txt',
+      'parallel: sh -c exit 3: exit 3',
+      CMD_MAX_TIME => 0.35 ],
+
+
+# Command files are parsed whole, so lines may be arbitrarily long
+    [ 'Test SCRIPT1',
+      'echo ' . ('x' x 9000) . " | wc -c\necho Next",
+      '9001 Next',
+      CMD_FILE => 1 ],
+
+    [ 'Test SCRIPT2',
+      "echo \"a  b\" 'c\\d' e\\ f \"g\\\"h\" 12> out.txt\n" . 'echo ' . ('"q"' x 3000) . ' | wc -c',
+      'a b c\\d e f g"h 3001',
+      CMD_FILE => 1 ],
+
+    [ 'Test SCRIPT3',
+      ('(' x 100000) . 'echo Deep' . (')' x 100000) . ' ; ' . ('true ; ' x 100000) . ('false || ' x 100000) . 'echo Done',
+      'Deep Done',
+      CMD_FILE => 1 ],
+
+
+# Command substitution
+    [ 'Test SUBST1',
+      'echo x$(echo Hello World)y "[$(echo one ; echo two)]" $(true) | tr a-z A-Z',
+      'XHELLO WORLDY [ONE TWO]' ],
+
+    [ 'Test SUBST2',
+      'echo $(seq 1 20000) | wc -w ; cd $(echo /) ; pwd ; echo $(echo $(echo Nested))',
+      '20000 / Nested' ],
+
+    # A substitution does not hold up the rest of its pipeline
+    [ 'Test SUBST3',
+      'sleep 0.2 | echo $(sleep 0.2 ; echo Done)',
+      'Done',
+      CMD_MAX_TIME => 0.35 ],
+
+
 # Interrupts
     [ 'Test INTR1',
       'echo a && sleep 0.2 && echo b',
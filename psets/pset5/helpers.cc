@@ -1,7 +1,7 @@
 #include "sh61.hh"
 #include <cctype>
 #include <cstring>
-#include <sstream>
+#include <cstdint>
 
 // isshellspecial(ch)
 //    Test if `ch` is a command that's special to the shell (that ends
@@ -35,19 +35,27 @@ void shell_token_iterator::update() {
 
     _len = 0;
     _quoted = false;
+    _subst = false;
 
     // Read token starting at _s, setting _type, _len, and _quoted.
     // - _len: Length of token in characters.
     // - _type: Type of token (one of the TYPE_ constants).
     // - _quoted: True iff this token contains quotes or escapes.
+    // - _subst: True iff this token contains a command substitution.
     while (isdigit((unsigned char) _s[_len])) {
         ++_len;
     }
     if (_s[_len] == '<' || _s[_len] == '>') {
-        // Redirection
+        // Redirection (`<<`, `<<-`, and `<<<` introduce here-documents
+        // and here-strings)
         ++_len;
         if (_s[_len] == '>') {
             ++_len;
+        } else if (_s[_len - 1] == '<' && _s[_len] == '<') {
+            ++_len;
+            if (_s[_len] == '<' || _s[_len] == '-') {
+                ++_len;
+            }
         } else {
             while (isdigit((unsigned char) _s[_len])) {
                 ++_len;
@@ -94,7 +102,12 @@ void shell_token_iterator::update() {
                || (_s[_len] != '\0'
                    && !isspace((unsigned char) _s[_len])
                    && !isshellspecial((unsigned char) _s[_len]))) {
-            if ((_s[_len] == '\"' || _s[_len] == '\'') && !curquote) {
+            if (_s[_len] == '$' && _s[_len+1] == '(' && curquote != '\'') {
+                // Command substitution: part of the word, up to the
+                // matching `)`
+                _len = skip_substitution(_s + _len + 2) - _s - 1;
+                _quoted = _subst = true;
+            } else if ((_s[_len] == '\"' || _s[_len] == '\'') && !curquote) {
                 curquote = _s[_len];
                 _quoted = true;
             } else if (_s[_len] == curquote) {
@@ -110,27 +123,102 @@ void shell_token_iterator::update() {
     }
 }
 
+const char* skip_substitution(const char* s) {
+    int depth = 1;
+    int curquote = 0;
+    for (; *s; ++s) {
+        if (curquote) {
+            if (*s == '\\' && curquote == '\"' && s[1]) {
+                ++s;
+            } else if (*s == curquote) {
+                curquote = 0;
+            }
+        } else if (*s == '\"' || *s == '\'') {
+            curquote = *s;
+        } else if (*s == '\\' && s[1]) {
+            ++s;
+        } else if (*s == '(') {
+            ++depth;
+        } else if (*s == ')' && --depth == 0) {
+            return s + 1;
+        }
+    }
+    return s;
+}
+
+size_t shell_token_iterator::unquote(char* buf) const {
+    if (!_quoted) {
+        memcpy(buf, _s, _len);
+        buf[_len] = '\0';
+        return _len;
+    }
+    size_t n = 0;
+    int curquote = 0;
+    for (unsigned pos = 0; pos != _len; ++pos) {
+        if ((_s[pos] == '\"' || _s[pos] == '\'') && !curquote) {
+            curquote = _s[pos];
+        } else if (_s[pos] == curquote) {
+            curquote = 0;
+        } else if (_s[pos] == '\\'
+                   && _s[pos+1] != '\0'
+                   && curquote != '\'') {
+            buf[n++] = _s[pos+1];
+            ++pos;
+        } else {
+            buf[n++] = _s[pos];
+        }
+    }
+    buf[n] = '\0';
+    return n;
+}
+
 std::string shell_token_iterator::str() const {
     if (!_quoted) {
         return std::string(_s, _len);
-    } else {
-        std::ostringstream build;
-        int curquote = 0;
-        for (unsigned pos = 0; pos != _len; ++pos) {
-            if ((_s[pos] == '\"' || _s[pos] == '\'') && !curquote) {
-                curquote = _s[pos];
-            } else if (_s[pos] == curquote) {
-                curquote = 0;
-            } else if (_s[pos] == '\\'
-                       && _s[pos+1] != '\0'
-                       && curquote != '\'') {
-                build << _s[pos+1];
-                ++pos;
-            } else {
-                build << _s[pos];
-            }
+    }
+    std::string s(_len + 1, '\0');
+    s.resize(unquote(&s[0]));
+    return s;
+}
+
+
+// arena::allocate(sz, align)
+//    Return `sz` bytes of memory aligned to `align`, valid until the
+//    arena is destroyed. Blocks double in size up to 64 KiB; larger
+//    requests get a block of their own.
+
+void* arena::allocate(size_t sz, size_t align) {
+    uintptr_t pos = ((uintptr_t) _pos + align - 1) & ~(uintptr_t) (align - 1);
+    if (!_pos || pos + sz > (uintptr_t) _end) {
+        size_t hdr = (sizeof(block) + align - 1) & ~(align - 1);
+        size_t bsz = _blocksize;
+        if (hdr + sz > bsz) {
+            bsz = hdr + sz;
+        } else if (_blocksize < 65536) {
+            _blocksize *= 2;
         }
-        return build.str();
+        block* b = static_cast<block*>(::operator new(bsz));
+        b->prev = _blocks;
+        _blocks = b;
+        pos = (uintptr_t) b + hdr;
+        _end = (char*) b + bsz;
+    }
+    _pos = (char*) pos + sz;
+    return (void*) pos;
+}
+
+
+// arena::~arena()
+//    Destroy the objects that need it, then free every block.
+
+arena::~arena() {
+    for (destructor* d = _destructors; d; d = d->prev) {
+        d->destroy(d->object);
+    }
+    while (_blocks) {
+        block* prev = _blocks->prev;
+        ::operator delete(_blocks);
+        _blocks = prev;
     }
 }
 
@@ -138,13 +226,14 @@ std::string shell_token_iterator::str() const {
 // claim_foreground(pgid)
 //    Mark `pgid` as the current foreground process group for this terminal.
 //    This uses some ugly Unix warts, so we provide it for you.
+static int ttyfd = -1;
+static int shell_owns_foreground = 0;
+static pid_t shell_pgid = -1;
+
 int claim_foreground(pid_t pgid) {
     // YOU DO NOT NEED TO UNDERSTAND THIS.
 
     // Initialize state first time we're called.
-    static int ttyfd = -1;
-    static int shell_owns_foreground = 0;
-    static pid_t shell_pgid = -1;
     if (ttyfd < 0) {
         // We need a fd for the current terminal, so open /dev/tty.
         int fd = open("/dev/tty", O_RDWR);
@@ -172,3 +261,12 @@ int claim_foreground(pid_t pgid) {
         return 0;
     }
 }
+
+
+// owns_foreground()
+//    Return true iff the shell was in the terminal's foreground process
+//    group when `claim_foreground` was first called, so that
+//    `claim_foreground` can hand the terminal to other process groups.
+bool owns_foreground() {
+    return shell_owns_foreground;
+}
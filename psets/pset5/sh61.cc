@@ -4,36 +4,111 @@
 #include <vector>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <ctime>
+#include <spawn.h>
+#include <poll.h>
 #include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <functional>
 
 static volatile sig_atomic_t recd_signal;
+static int sigchld_pipe[2];  // self-pipe written on SIGCHLD
+static pid_t shell_pid;      // process ID of the top-level shell
+static pid_t job_pgid;       // process group for pipelines, 0 for a new one each
+static bool report_jobs;     // true iff job status changes are printed
+static bool exec_last;       // true iff the last command may replace the shell
+static struct command* exec_subshell;  // list for `run` to continue with
+static bool opt_pipefail;    // `set -o pipefail`: any failing stage fails
+static bool opt_pipestats;   // `set -o pipestats`: report each stage
+
+// struct redirection
+//    A redirection of one file descriptor, such as `2> err.txt`. A
+//    here-document (`<< EOF`) or here-string (`<<< word`) redirects
+//    from `body` instead of a file.
+
+enum here_type {
+    HERE_NONE = 0,      // not a here-document: open `file`
+    HERE_DOC,           // `<< DELIM`
+    HERE_DOC_STRIP,     // `<<- DELIM`: leading tabs are stripped
+    HERE_STRING         // `<<< word`
+};
+
+struct redirection {
+    int fd;             // file descriptor redirected
+    int flags;          // flags for opening `file`
+    const char* file;   // file name (delimiter, for a here-document)
+    redirection* next;  // next redirection, in command-line order
+    here_type here;     // kind of here-document, if any
+    const char* body;   // here-document contents; nullptr until read
+    size_t bodylen;     // length of `body`
+};
+
+
+// time_format
+//    How to report a pipeline run under the `time` keyword.
+
+enum time_format {
+    TIME_NONE = 0,      // not timed
+    TIME_TEXT,          // `time PIPELINE`: human-readable
+    TIME_JSON           // `time -j PIPELINE`: JSON, as `profile61` prints
+};
+
 
 // struct command
 //    Data structure describing a command. Add your own stuff.
+//
+//    Commands live in an `arena` along with their arguments and
+//    redirections, and are never destroyed individually, so `command`
+//    must stay trivially destructible.
 
 struct command {
-    std::vector<std::string> args;   // vector of arguments
+    const char** argv;  // null-terminated argument vector
+    unsigned argc;      // number of arguments
+    unsigned argcap;    // capacity of `argv`, including the null
     pid_t pid;      // process ID running this command, -1 if none
     command* next;  // next command in linked list
     int link;       // control operator terminating this command
     int readfd;     // read-end fd if read end of pipe, -1 otherwise
+    int status;     // exit status, once run
+    struct rusage usage;    // resource usage of `pid`, once waited for
+    time_format time;       // set in a pipeline's first command if timed
 
-    // Redirections
-    // input files: key - fd, value - filename
-    std::unordered_map<int, std::string> in_files;
-    // output files: key - fd, value - pair of filename and mode (O_TRUNC or O_APPEND)
-    std::unordered_map<int, std::pair<std::string, int>> out_files;
+    // Redirections, applied in order
+    redirection* redirs;
 
     // Subshells
     command* sub_front;  // pointer to first command of subshell, nullptr if none
     bool sub_bg;         // true iff this is being run inside a background subshell
 
+    // Command substitution
+    bool subst;     // true iff `argv` holds raw words, some with `$(...)`
+
     command();
-    ~command();
+    command(const command&) = delete;
+    command& operator=(const command&) = delete;
 
+    void add_arg(const char* arg, arena& a);
     pid_t make_child(pid_t pgid);
+    void run_in_shell(const struct builtin* b);
+    void exec_in_place();
+    void expand(arena& a);
+
+private:
+    const char* argv_inline[8];  // `argv` for commands with few arguments
+
+    bool redirects(int fd) const;
+    bool open_redirections(std::vector<std::pair<int, int>>& fds);
+    void run_in_shell_with(const struct builtin* b,
+                           std::vector<std::pair<int, int>>& fds);
 };
 
+static_assert(std::is_trivially_destructible<command>::value,
+              "commands are freed with their arena");
+
 
 // run(c)
 //    Runs the given command and returns exit status.
@@ -47,25 +122,38 @@ int run(command*);
 //    add stuff to it as you grow the command structure.
 
 command::command() {
+    this->argv = this->argv_inline;
+    this->argv[0] = nullptr;
+    this->argc = 0;
+    this->argcap = sizeof(this->argv_inline) / sizeof(this->argv_inline[0]);
     this->pid = -1;
     this->next = nullptr;
     this->link = TYPE_SEQUENCE;
     this->readfd = -1;
+    this->status = EXIT_FAILURE;
+    memset(&this->usage, 0, sizeof(this->usage));
+    this->time = TIME_NONE;
     this->sub_front = nullptr;
     this->sub_bg = false;
+    this->redirs = nullptr;
+    this->subst = false;
 }
 
 
-// command::~command()
-//    This destructor function is called to delete a command.
+// command::add_arg(arg, a)
+//    Append `arg` to this command's arguments, growing `argv` in arena
+//    `a` if necessary.
 
-command::~command() {
-    if (this->sub_front) {
-        delete this->sub_front;
-    }
-    if (this->next) {
-        delete this->next;
+void command::add_arg(const char* arg, arena& a) {
+    if (this->argc + 1 == this->argcap) {
+        const char** newargv = a.make_array<const char*>(this->argcap * 2);
+        memcpy(newargv, this->argv, this->argc * sizeof(const char*));
+        this->argv = newargv;
+        this->argcap *= 2;
     }
+    this->argv[this->argc] = arg;
+    ++this->argc;
+    this->argv[this->argc] = nullptr;
 }
 
 
@@ -77,157 +165,1293 @@ void signal_handler(int signal) {
     recd_signal = 1;
 }
 
+
+// sigchld_handler(signal)
+//    Handles SIGCHLD signals for the shell by waking up the main loop,
+//    which collects the children.
+
+void sigchld_handler(int signal) {
+    (void) signal;
+    int saved_errno = errno;
+    ssize_t r = write(sigchld_pipe[1], "", 1);
+    (void) r;   // if the pipe is full, a wakeup is already pending
+    errno = saved_errno;
+}
+
+// COMMAND LOOKUP
+
+// path_cache
+//    Maps command names to the executables found for them on PATH, like
+//    the `hash` table of other shells. `path_cache_path` is the PATH the
+//    entries were found on; the cache is emptied when PATH changes.
+
+static std::unordered_map<std::string, std::string> path_cache;
+static std::string path_cache_path;
+
+
+// lookup_command(name, refresh)
+//    Return the executable that runs command `name`: `name` itself if it
+//    contains a slash, otherwise the first executable regular file
+//    `DIR/name` for DIR on PATH. Returns an empty string if there is
+//    none. Found paths are cached unless they depend on the working
+//    directory. If `refresh` is true, any cached path is searched again.
+
+static std::string lookup_command(const std::string& name, bool refresh) {
+    if (name.find('/') != std::string::npos) {
+        return name;
+    }
+    const char* path = getenv("PATH");
+    if (!path) {
+        path = "/bin:/usr/bin";
+    }
+    if (path_cache_path != path) {
+        path_cache.clear();
+        path_cache_path = path;
+    }
+    auto it = path_cache.find(name);
+    if (it != path_cache.end()) {
+        if (!refresh) {
+            return it->second;
+        }
+        path_cache.erase(it);
+    }
+
+    const char* dir = path;
+    while (true) {
+        const char* colon = strchrnul(dir, ':');
+        std::string file(dir, colon - dir);
+        if (file.empty()) {
+            file = ".";
+        }
+        bool absolute = file[0] == '/';
+        file += '/';
+        file += name;
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode)
+            && access(file.c_str(), X_OK) == 0) {
+            if (absolute) {
+                path_cache[name] = file;
+            }
+            return file;
+        }
+        if (!*colon) {
+            return std::string();
+        }
+        dir = colon + 1;
+    }
+}
+
+
+// script_argv(file, argv)
+//    Return the arguments that run `file`, an executable the kernel
+//    cannot load (ENOEXEC), as a shell script, the way `execvp` does:
+//    `/bin/sh file ARGS...`.
+
+static std::vector<const char*> script_argv(const std::string& file,
+                                            const char* const* argv) {
+    std::vector<const char*> sargv = {"/bin/sh", file.c_str()};
+    for (int i = 1; argv[i]; ++i) {
+        sargv.push_back(argv[i]);
+    }
+    sargv.push_back(nullptr);
+    return sargv;
+}
+
+
+// spawn_command(pid, argv, actions, attr)
+//    Start the program for command `argv` with `posix_spawn`, storing
+//    its process ID in `*pid`. If a remembered path fails, PATH is
+//    searched once more. Executables without a recognized format run as
+//    shell scripts. Returns 0 or an error number.
+
+static int spawn_command(pid_t* pid, const char* const* argv,
+                         const posix_spawn_file_actions_t* actions,
+                         const posix_spawnattr_t* attr) {
+    int r = ENOENT;
+    for (int tries = 0; tries != 2 && r == ENOENT; ++tries) {
+        std::string file = lookup_command(argv[0], tries != 0);
+        if (!file.empty()) {
+            r = posix_spawn(pid, file.c_str(), actions, attr,
+                            (char**) argv, environ);
+            if (r == ENOEXEC) {
+                auto sargv = script_argv(file, argv);
+                r = posix_spawn(pid, sargv[0], actions, attr,
+                                (char**) sargv.data(), environ);
+            }
+        }
+    }
+    return r;
+}
+
+
+// exec_command(argv)
+//    Replace this process with the program for command `argv`, found as
+//    `spawn_command` finds it. On failure, prints an error and exits.
+
+[[noreturn]] static void exec_command(const char* const* argv) {
+    fflush(stdout);
+    int r = ENOENT;
+    for (int tries = 0; tries != 2 && r == ENOENT; ++tries) {
+        std::string file = lookup_command(argv[0], tries != 0);
+        if (!file.empty()) {
+            execv(file.c_str(), (char**) argv);
+            r = errno;
+            if (r == ENOEXEC) {
+                auto sargv = script_argv(file, argv);
+                execv(sargv[0], (char**) sargv.data());
+                r = errno;
+            }
+        }
+    }
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(r));
+    _exit(EXIT_FAILURE);
+}
+
+
+// JOB CONTROL
+
+// struct job
+//    A background job, or a foreground pipeline that was stopped. A
+//    background job is a child shell leading its own process group, so
+//    signals sent to the group reach every process in the job.
+
+enum job_state { JOB_RUNNING, JOB_STOPPED, JOB_DONE };
+
+struct job {
+    int id;             // job number, as in `%1`
+    pid_t pgid;         // process group of the job's processes
+    pid_t pid;          // process whose status is the job's status
+    job_state state;
+    int wstatus;        // wait status, if stopped or done
+    bool reported;      // true iff the current state has been reported
+    std::string text;   // command text, for reports
+};
+
+static std::map<int, job> jobs;                 // job table, by job number
+static std::unordered_map<pid_t, int> job_pids; // job number, by `pid`
+
+
+// append_words(text, c)
+//    Helper for `command_text`: append the arguments and redirections
+//    of command `c`, which follow its subshell text if any.
+
+static void append_words(std::string& text, command* c) {
+    for (unsigned i = 0; i < c->argc; ++i) {
+        if (i != 0 || c->sub_front) {
+            text += ' ';
+        }
+        text += c->argv[i];
+    }
+    for (redirection* r = c->redirs; r; r = r->next) {
+        bool in = (r->flags & O_ACCMODE) == O_RDONLY;
+        text += ' ';
+        if (r->here == HERE_STRING) {
+            text += "<<< ";
+            text.append(r->body, r->bodylen - 1);
+            continue;
+        } else if (r->here != HERE_NONE) {
+            text += r->here == HERE_DOC ? "<< " : "<<- ";
+            text += r->file;
+            continue;
+        }
+        if (r->fd != (in ? STDIN_FILENO : STDOUT_FILENO)) {
+            text += std::to_string(r->fd);
+        }
+        text += in ? "< " : (r->flags & O_APPEND ? ">> " : "> ");
+        text += r->file;
+    }
+}
+
+
+// command_text(c, last)
+//    Return printable text for the commands from `c` through `last`
+//    (through the end of the list if `last` is nullptr). Subshells are
+//    entered with an explicit stack, so deep nesting uses no C stack.
+
+static std::string command_text(command* c, command* last) {
+    std::string text;
+    std::vector<command*> outer;    // commands whose subshells enclose `c`
+    while (true) {
+        if (c->sub_front) {
+            text += '(';
+            outer.push_back(c);
+            c = c->sub_front;
+            continue;
+        }
+        append_words(text, c);
+        // Close the subshells that end with `c`
+        while (outer.empty() ? c == last || !c->next : !c->next) {
+            if (outer.empty()) {
+                return text;
+            }
+            c = outer.back();
+            outer.pop_back();
+            text += ')';
+            append_words(text, c);
+        }
+        if (c->link == TYPE_PIPE) {
+            text += " | ";
+        } else if (c->link == TYPE_AND) {
+            text += " && ";
+        } else if (c->link == TYPE_OR) {
+            text += " || ";
+        } else if (c->link == TYPE_BACKGROUND) {
+            text += " & ";
+        } else {
+            text += "; ";
+        }
+        c = c->next;
+    }
+}
+
+
+// exit_status_of(wstatus)
+//    Return the exit status corresponding to wait status `wstatus`:
+//    a process killed or stopped by signal N has status 128 + N.
+
+static int exit_status_of(int wstatus) {
+    if (WIFEXITED(wstatus)) {
+        return WEXITSTATUS(wstatus);
+    } else if (WIFSIGNALED(wstatus)) {
+        return 128 + WTERMSIG(wstatus);
+    } else if (WIFSTOPPED(wstatus)) {
+        return 128 + WSTOPSIG(wstatus);
+    } else {
+        return EXIT_FAILURE;
+    }
+}
+
+
+// add_job(pgid, pid, state, text)
+//    Add a job to the job table and return it. Its number is one more
+//    than the largest in use.
+
+static job& add_job(pid_t pgid, pid_t pid, job_state state,
+                    std::string text) {
+    int id = jobs.empty() ? 1 : jobs.rbegin()->first + 1;
+    job& j = jobs[id];
+    j = {id, pgid, pid, state, 0, false, std::move(text)};
+    job_pids[pid] = id;
+    return j;
+}
+
+
+// remove_job(j)
+//    Forget job `j`.
+
+static void remove_job(job& j) {
+    job_pids.erase(j.pid);
+    jobs.erase(j.id);
+}
+
+
+// update_job(pid, wstatus)
+//    Record that process `pid` changed state, as reported by `waitpid`.
+//    Processes that are not a job's `pid` are ignored.
+
+static void update_job(pid_t pid, int wstatus) {
+    auto it = job_pids.find(pid);
+    if (it == job_pids.end()) {
+        return;
+    }
+    job& j = jobs.at(it->second);
+    if (WIFCONTINUED(wstatus)) {
+        j.state = JOB_RUNNING;
+        return;
+    }
+    j.state = WIFSTOPPED(wstatus) ? JOB_STOPPED : JOB_DONE;
+    j.wstatus = wstatus;
+    j.reported = false;
+}
+
+
+// reap_jobs()
+//    Collect every child that has changed state, without blocking, and
+//    update the job table. Runs whenever the SIGCHLD self-pipe is
+//    readable and between commands, so zombies never pile up.
+
+static void reap_jobs() {
+    char buf[64];
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+    int wstatus;
+    pid_t pid;
+    while ((pid = waitpid(-1, &wstatus, WNOHANG | WUNTRACED | WCONTINUED))
+           > 0) {
+        update_job(pid, wstatus);
+    }
+}
+
+
+// wait_job(j)
+//    Block until job `j` is no longer running. Returns false if
+//    interrupted by SIGINT first.
+
+static bool wait_job(job& j) {
+    while (j.state == JOB_RUNNING) {
+        int wstatus;
+        pid_t pid = waitpid(j.pid, &wstatus, WUNTRACED);
+        if (pid == j.pid) {
+            update_job(pid, wstatus);
+        } else if (pid == -1 && errno == EINTR) {
+            if (recd_signal) {
+                return false;
+            }
+        } else {
+            // Not our child (e.g., `wait` run in a pipeline)
+            j.state = JOB_DONE;
+            j.wstatus = W_EXITCODE(127, 0);
+        }
+    }
+    return true;
+}
+
+
+// print_job(j)
+//    Print a line describing job `j`, and mark it reported.
+
+static void print_job(job& j) {
+    std::string state;
+    if (j.state == JOB_RUNNING) {
+        state = "Running";
+    } else if (j.state == JOB_STOPPED) {
+        state = "Stopped";
+    } else if (WIFSIGNALED(j.wstatus)) {
+        state = strsignal(WTERMSIG(j.wstatus));
+    } else if (exit_status_of(j.wstatus) != 0) {
+        state = "Exit " + std::to_string(exit_status_of(j.wstatus));
+    } else {
+        state = "Done";
+    }
+    printf("[%d]  %-24s%s\n", j.id, state.c_str(), j.text.c_str());
+    j.reported = true;
+}
+
+
+// notify_jobs()
+//    Report jobs that stopped or finished since they were last reported,
+//    and forget the finished ones. Runs before each prompt.
+
+static void notify_jobs() {
+    for (auto it = jobs.begin(); it != jobs.end(); ) {
+        job& j = (it++)->second;
+        if (!j.reported) {
+            print_job(j);
+        }
+        if (j.state == JOB_DONE) {
+            remove_job(j);
+        }
+    }
+    fflush(stdout);
+}
+
+
+// find_job(spec, who)
+//    Return the job named by `spec`: `%N` for job number N, a process
+//    ID, or the most recent job if `spec` is nullptr, `%%`, or `%+`.
+//    Prints an error attributed to builtin `who` and returns nullptr if
+//    there is no such job.
+
+static job* find_job(const char* spec, const char* who) {
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        if (!jobs.empty()) {
+            return &jobs.rbegin()->second;
+        }
+        fprintf(stderr, "%s: no current job\n", who);
+        return nullptr;
+    }
+    char* end;
+    long n = strtol(spec + (spec[0] == '%'), &end, 10);
+    if (*end == '\0' && end != spec + (spec[0] == '%')) {
+        if (spec[0] == '%' && jobs.count(n)) {
+            return &jobs.at(n);
+        } else if (spec[0] != '%' && job_pids.count(n)) {
+            return &jobs.at(job_pids.at(n));
+        }
+    }
+    fprintf(stderr, "%s: %s: no such job\n", who, spec);
+    return nullptr;
+}
+
+
+// BUILTIN COMMANDS
+
+// write_all(fd, data, sz)
+//    Write all `sz` bytes at `data` to `fd`. Returns false on error.
+
+static bool write_all(int fd, const char* data, size_t sz) {
+    size_t pos = 0;
+    while (pos < sz) {
+        ssize_t w = write(fd, data + pos, sz - pos);
+        if (w > 0) {
+            pos += w;
+        } else if (w == -1 && errno != EINTR && errno != EAGAIN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// builtin_cd(c)
+//    `cd [DIR]`: change the shell's working directory (default `.`).
+
+static int builtin_cd(command* c) {
+    if (c->argc > 2) {
+        fprintf(stderr, "cd: too many arguments\n");
+        return EXIT_FAILURE;
+    }
+    const char* dir = c->argc > 1 ? c->argv[1] : ".";
+    if (chdir(dir) == -1) {
+        perror(dir);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+// builtin_exit(c)
+//    `exit [STATUS]`: terminate the shell.
+
+static int builtin_exit(command* c) {
+    fflush(stdout);
+    exit(c->argc > 1 ? atoi(c->argv[1]) : EXIT_SUCCESS);
+}
+
+
+// builtin_true(c), builtin_false(c)
+//    `true` and `false`: do nothing, successfully or not.
+
+static int builtin_true(command*) {
+    return EXIT_SUCCESS;
+}
+
+static int builtin_false(command*) {
+    return EXIT_FAILURE;
+}
+
+
+// builtin_echo(c)
+//    `echo [-n] ARGS...`: print ARGS separated by spaces. The output is
+//    written with one `write` call so that it is not mixed with output
+//    the shell has buffered.
+
+static int builtin_echo(command* c) {
+    unsigned i = 1;
+    bool newline = true;
+    if (i < c->argc && strcmp(c->argv[i], "-n") == 0) {
+        newline = false;
+        ++i;
+    }
+    std::string out;
+    for (; i < c->argc; ++i) {
+        out += c->argv[i];
+        if (i + 1 < c->argc) {
+            out += ' ';
+        }
+    }
+    if (newline) {
+        out += '\n';
+    }
+    return write_all(STDOUT_FILENO, out.data(), out.size())
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+// builtin_export(c)
+//    `export NAME=VALUE...`: set environment variables. (The shell has
+//    no unexported variables, so `export NAME` does nothing.)
+
+static int builtin_export(command* c) {
+    int status = EXIT_SUCCESS;
+    for (unsigned i = 1; i < c->argc; ++i) {
+        const char* eq = strchr(c->argv[i], '=');
+        if (eq == c->argv[i]) {
+            fprintf(stderr, "export: %s: not a valid identifier\n",
+                    c->argv[i]);
+            status = EXIT_FAILURE;
+        } else if (eq) {
+            std::string name(c->argv[i], eq - c->argv[i]);
+            setenv(name.c_str(), eq + 1, 1);
+        }
+    }
+    return status;
+}
+
+
+// builtin_unset(c)
+//    `unset NAME...`: remove environment variables.
+
+static int builtin_unset(command* c) {
+    for (unsigned i = 1; i < c->argc; ++i) {
+        unsetenv(c->argv[i]);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+// builtin_hash(c)
+//    `hash [-r] [NAME...]`: with NAMEs, look them up on PATH and
+//    remember their locations; with `-r`, forget all locations; with
+//    neither, print the remembered locations.
+
+static int builtin_hash(command* c) {
+    unsigned i = 1;
+    if (i < c->argc && strcmp(c->argv[i], "-r") == 0) {
+        path_cache.clear();
+        ++i;
+    } else if (i == c->argc) {
+        std::map<std::string, std::string> sorted(path_cache.begin(),
+                                                  path_cache.end());
+        for (auto& entry : sorted) {
+            printf("%s\t%s\n", entry.first.c_str(), entry.second.c_str());
+        }
+        fflush(stdout);
+    }
+    int status = EXIT_SUCCESS;
+    for (; i < c->argc; ++i) {
+        if (lookup_command(c->argv[i], true).empty()) {
+            fprintf(stderr, "hash: %s: not found\n", c->argv[i]);
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+
+// builtin_jobs(c)
+//    `jobs`: list jobs and their states, forgetting finished ones.
+
+static int builtin_jobs(command*) {
+    reap_jobs();
+    for (auto it = jobs.begin(); it != jobs.end(); ) {
+        job& j = (it++)->second;
+        print_job(j);
+        if (j.state == JOB_DONE) {
+            remove_job(j);
+        }
+    }
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
+
+// builtin_wait(c)
+//    `wait [JOB...]`: wait for the named jobs, or for all jobs, to stop
+//    or finish. Returns the status of the last named job.
+
+static int builtin_wait(command* c) {
+    std::vector<int> ids;
+    int status = EXIT_SUCCESS;
+    for (unsigned i = 1; i < c->argc; ++i) {
+        if (job* j = find_job(c->argv[i], "wait")) {
+            ids.push_back(j->id);
+        } else {
+            status = 127;
+        }
+    }
+    if (c->argc == 1) {
+        for (auto& it : jobs) {
+            ids.push_back(it.first);
+        }
+    }
+    for (int id : ids) {
+        auto it = jobs.find(id);
+        if (it == jobs.end()) {
+            continue;       // named twice
+        }
+        if (!wait_job(it->second)) {
+            return 128 + SIGINT;
+        }
+        if (c->argc != 1) {
+            status = exit_status_of(it->second.wstatus);
+        }
+        if (it->second.state == JOB_DONE) {
+            remove_job(it->second);
+        }
+    }
+    return status;
+}
+
+
+// builtin_fg(c)
+//    `fg [JOB]`: continue a job in the foreground and wait for it.
+
+static int builtin_fg(command* c) {
+    job* j = find_job(c->argc > 1 ? c->argv[1] : nullptr, "fg");
+    if (!j) {
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", j->text.c_str());
+    fflush(stdout);
+    j->state = JOB_RUNNING;
+    j->reported = true;
+    claim_foreground(j->pgid);
+    kill(-j->pgid, SIGCONT);
+    wait_job(*j);
+    claim_foreground(0);
+    int status = exit_status_of(j->wstatus);
+    if (j->state == JOB_DONE) {
+        remove_job(*j);
+    }
+    return status;
+}
+
+
+// builtin_bg(c)
+//    `bg [JOB]`: continue a stopped job in the background.
+
+static int builtin_bg(command* c) {
+    job* j = find_job(c->argc > 1 ? c->argv[1] : nullptr, "bg");
+    if (!j) {
+        return EXIT_FAILURE;
+    }
+    if (j->state == JOB_STOPPED) {
+        j->state = JOB_RUNNING;
+        kill(-j->pgid, SIGCONT);
+    }
+    if (report_jobs) {
+        printf("[%d]  %s &\n", j->id, j->text.c_str());
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+// builtin_parallel(c)
+//    `parallel [-j N] [-k] COMMAND... ::: INPUT...`: run COMMAND once
+//    per INPUT, at most N at a time (default: one per CPU). `{}` in
+//    COMMAND stands for the input; with no `{}`, the input is added as a
+//    last argument. Each run's standard output is collected and printed
+//    in one piece when the run finishes, or, with `-k`, in input order.
+//    Failed runs are reported on standard error, and make the status 1.
+//    Runs stay in the shell's process group, so an interrupt from the
+//    terminal stops them all (and no more are started).
+
+struct parallel_run {
+    pid_t pid = -1;
+    int fd = -1;            // read end of output pipe, -1 once closed
+    std::string output;
+    bool done = false;
+    bool reported = false;
+    int wstatus = 0;
+    std::string text;       // command text, for reports
+};
+
+static void parallel_start(parallel_run& run,
+                           const std::vector<const char*>& tmpl,
+                           const char* input, int nullfd) {
+    // Substitute the input into the template
+    std::vector<std::string> words;
+    bool substituted = false;
+    for (const char* word : tmpl) {
+        std::string w = word;
+        for (size_t pos; (pos = w.find("{}")) != std::string::npos; ) {
+            w.replace(pos, 2, input);
+            substituted = true;
+        }
+        words.push_back(std::move(w));
+    }
+    if (!substituted) {
+        words.push_back(input);
+    }
+    std::vector<const char*> argv;
+    for (auto& w : words) {
+        run.text += (argv.empty() ? "" : " ") + w;
+        argv.push_back(w.c_str());
+    }
+    argv.push_back(nullptr);
+
+    // Start it with output to a pipe
+    int pfd[2];
+    int r = pipe2(pfd, O_CLOEXEC) == -1 ? errno : 0;
+    if (r == 0) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, nullfd, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, pfd[1], STDOUT_FILENO);
+        r = spawn_command(&run.pid, argv.data(), &actions, nullptr);
+        posix_spawn_file_actions_destroy(&actions);
+        close(pfd[1]);
+        if (r == 0) {
+            run.fd = pfd[0];
+        } else {
+            close(pfd[0]);
+        }
+    }
+    if (r != 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(r));
+        run.done = true;
+        run.wstatus = W_EXITCODE(127, 0);
+    }
+}
+
+static int builtin_parallel(command* c) {
+    long maxrunning = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep_order = false;
+    unsigned i = 1;
+    for (; i < c->argc && c->argv[i][0] == '-'; ++i) {
+        if (strcmp(c->argv[i], "-k") == 0) {
+            keep_order = true;
+        } else if (strcmp(c->argv[i], "-j") == 0 && i + 1 < c->argc) {
+            maxrunning = strtol(c->argv[++i], nullptr, 10);
+        } else if (strncmp(c->argv[i], "-j", 2) == 0 && c->argv[i][2]) {
+            maxrunning = strtol(c->argv[i] + 2, nullptr, 10);
+        } else {
+            break;
+        }
+    }
+    std::vector<const char*> tmpl;
+    for (; i < c->argc && strcmp(c->argv[i], ":::") != 0; ++i) {
+        tmpl.push_back(c->argv[i]);
+    }
+    if (tmpl.empty() || i == c->argc || maxrunning < 1) {
+        fprintf(stderr, "Usage: parallel [-j N] [-k] COMMAND... ::: INPUT...\n");
+        return 2;
+    }
+    std::vector<parallel_run> runs(c->argc - i - 1);
+    int nullfd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    size_t nstarted = 0, nfinished = 0, nprinted = 0;
+    long nrunning = 0;
+    int status = EXIT_SUCCESS;
+    std::vector<struct pollfd> pfds;
+    std::vector<size_t> pruns;
+    while (nfinished < nstarted || (nstarted < runs.size() && !recd_signal)) {
+        // Start runs up to the limit
+        while (nstarted < runs.size() && nrunning < maxrunning
+               && !recd_signal) {
+            parallel_start(runs[nstarted], tmpl, c->argv[i + 1 + nstarted],
+                           nullfd);
+            ++nstarted;
+            ++nrunning;
+        }
+
+        // Wait for output from any run
+        pfds.clear();
+        pruns.clear();
+        for (size_t r = nprinted; r < nstarted; ++r) {
+            if (runs[r].fd >= 0) {
+                pfds.push_back({runs[r].fd, POLLIN, 0});
+                pruns.push_back(r);
+            }
+        }
+        if (!pfds.empty() && poll(pfds.data(), pfds.size(), -1) == -1) {
+            continue;   // EINTR
+        }
+
+        // Collect output; a run finishes when its output ends
+        for (size_t p = 0; p < pfds.size(); ++p) {
+            parallel_run& run = runs[pruns[p]];
+            if (pfds[p].revents) {
+                char buf[BUFSIZ];
+                ssize_t n = read(run.fd, buf, sizeof(buf));
+                if (n > 0) {
+                    run.output.append(buf, n);
+                } else if (n == 0 || errno != EINTR) {
+                    close(run.fd);
+                    run.fd = -1;
+                    while (waitpid(run.pid, &run.wstatus, 0) == -1
+                           && errno == EINTR) {
+                    }
+                    run.done = true;
+                }
+            }
+        }
+
+        // Report finished runs, in order if requested
+        for (size_t r = nprinted; r < nstarted; ++r) {
+            parallel_run& run = runs[r];
+            if (!run.done && keep_order) {
+                break;
+            } else if (!run.done || run.reported) {
+                continue;
+            }
+            write_all(STDOUT_FILENO, run.output.data(), run.output.size());
+            if (run.wstatus != 0) {
+                fprintf(stderr, "parallel: %s: exit %d\n", run.text.c_str(),
+                        exit_status_of(run.wstatus));
+                status = EXIT_FAILURE;
+            }
+            run.output = std::string();
+            run.reported = true;
+            ++nfinished;
+            --nrunning;
+            while (nprinted < nstarted && runs[nprinted].reported) {
+                ++nprinted;
+            }
+        }
+    }
+    close(nullfd);
+    return recd_signal ? 128 + SIGINT : status;
+}
+
+
+// builtin_set(c)
+//    `set -o OPTION` turns a shell option on; `set +o OPTION` turns it
+//    off; `set -o` lists the options. The options are:
+//        pipefail    A pipeline's status is that of its last failing
+//                    stage, rather than that of its last stage.
+//        pipestats   After each pipeline, print each stage's status and
+//                    resource usage on standard error.
+
+static const struct {
+    const char* name;
+    bool* value;
+} shell_options[] = {
+    {"pipefail", &opt_pipefail},
+    {"pipestats", &opt_pipestats}
+};
+
+static int builtin_set(command* c) {
+    if (c->argc == 2 && strcmp(c->argv[1], "-o") == 0) {
+        for (auto& opt : shell_options) {
+            printf("%-16s%s\n", opt.name, *opt.value ? "on" : "off");
+        }
+        fflush(stdout);
+        return EXIT_SUCCESS;
+    }
+    int status = EXIT_SUCCESS;
+    for (unsigned i = 1; i < c->argc; i += 2) {
+        bool on = strcmp(c->argv[i], "-o") == 0;
+        if ((!on && strcmp(c->argv[i], "+o") != 0) || i + 1 == c->argc) {
+            fprintf(stderr, "Usage: set [-o|+o] OPTION...\n");
+            return 2;
+        }
+        bool found = false;
+        for (auto& opt : shell_options) {
+            if (strcmp(c->argv[i + 1], opt.name) == 0) {
+                *opt.value = on;
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "set: %s: invalid option name\n", c->argv[i + 1]);
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
+
+
+// builtins
+//    Table of commands the shell implements itself.
+
+struct builtin {
+    const char* name;
+    int (*fn)(command* c);
+};
+
+static const builtin builtins[] = {
+    {"cd", builtin_cd},
+    {"exit", builtin_exit},
+    {"true", builtin_true},
+    {"false", builtin_false},
+    {"echo", builtin_echo},
+    {"export", builtin_export},
+    {"unset", builtin_unset},
+    {"hash", builtin_hash},
+    {"jobs", builtin_jobs},
+    {"wait", builtin_wait},
+    {"fg", builtin_fg},
+    {"bg", builtin_bg},
+    {"parallel", builtin_parallel},
+    {"set", builtin_set}
+};
+
+
+// find_builtin(c)
+//    Return the builtin that implements command `c`, or nullptr if `c`
+//    runs a program (or a subshell).
+
+static const builtin* find_builtin(command* c) {
+    if (c->sub_front || c->argc == 0) {
+        return nullptr;
+    }
+    for (auto& b : builtins) {
+        if (strcmp(c->argv[0], b.name) == 0) {
+            return &b;
+        }
+    }
+    return nullptr;
+}
+
+
 // COMMAND EXECUTION
 
+// command::redirects(fd)
+//    Return true iff this command redirects `fd`.
+
+bool command::redirects(int fd) const {
+    for (redirection* r = this->redirs; r; r = r->next) {
+        if (r->fd == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// open_here(body, len)
+//    Return a close-on-exec fd from which the here-document `body` can
+//    be read, or -1 on error. Nothing touches the filesystem: a body
+//    that fits in a pipe's buffer is written into a pipe whose write
+//    end is then closed, so no process has to feed it; a larger body
+//    goes into an anonymous memory file (`memfd_create`).
+
+static int open_here(const char* body, size_t len) {
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) == 0) {
+        int cap = fcntl(pfd[1], F_GETPIPE_SZ);
+        if (cap >= 0 && len <= size_t(cap)
+            && write_all(pfd[1], body, len)) {
+            close(pfd[1]);
+            return pfd[0];
+        }
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+    int fd = memfd_create("sh61-here", MFD_CLOEXEC);
+    if (fd >= 0
+        && (!write_all(fd, body, len) || lseek(fd, 0, SEEK_SET) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+
+// command::open_redirections(fds)
+//    Open the files named by this command's redirections in the shell,
+//    appending (opened fd, target fd) pairs to `fds`. Opened fds are
+//    close-on-exec and numbered 10 or above, so installing one cannot
+//    clobber another. On failure, prints an error, closes any files
+//    already opened, and returns false.
+
+bool command::open_redirections(std::vector<std::pair<int, int>>& fds) {
+    auto add = [&] (int fd, const char* name, int target) {
+        int hfd = fd >= 0 ? fcntl(fd, F_DUPFD_CLOEXEC, 10) : -1;
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (hfd == -1) {
+            perror(name);
+            return false;
+        }
+        fds.push_back({hfd, target});
+        return true;
+    };
+    bool ok = true;
+    for (redirection* r = this->redirs; r && ok; r = r->next) {
+        if (r->here != HERE_NONE) {
+            ok = add(open_here(r->body, r->bodylen), "sh61", r->fd);
+        } else {
+            ok = add(open(r->file, r->flags | O_CLOEXEC, 0666), r->file,
+                     r->fd);
+        }
+    }
+    if (!ok) {
+        for (auto& fp : fds) {
+            close(fp.first);
+        }
+        fds.clear();
+    }
+    return ok;
+}
+
+
 // command::make_child(pgid)
 //    Create a single child process running the command in `this`.
 //    Sets `this->pid` to the pid of the child process and returns `this->pid`.
+//    Returns -1 if the child could not be started (for instance, because
+//    a redirection failed); the command then counts as failed.
 //
-//    PART 1: Fork a child process and run the command using `execvp`.
-//       This will require creating an array of `char*` arguments using
-//       `this->args[N].c_str()`.
-//    PART 5: Set up a pipeline if appropriate. This may require creating a
-//       new pipe (`pipe` system call), and/or replacing the child process's
-//       standard input/output with parts of the pipe (`dup2` and `close`).
-//       Draw pictures!
-//    PART 7: Handle redirections.
-//    PART 8: The child process should be in the process group `pgid`, or
-//       its own process group (if `pgid == 0`). To avoid race conditions,
-//       this will require TWO calls to `setpgid`.
+//    Ordinary commands are launched with `posix_spawn` on the path found
+//    by `lookup_command`, which avoids searching PATH for every command
+//    and copying the shell's page tables: redirections and pipe ends are
+//    installed by file actions, and the process group is set by a spawn
+//    attribute (so no second `setpgid` is needed). Subshells, builtins,
+//    and commands with substitutions must run shell code in the child,
+//    so they still `fork`.
+//    (A builtin reaches here only as part of a pipeline; otherwise the
+//    shell runs it with `run_in_shell`.)
 
 pid_t command::make_child(pid_t pgid) {
-    // Set up argument vector
-    const char* argv[args.size() + 1];
-    for (size_t i = 0; i < args.size(); ++i) {
-        argv[i] = this->args[i].c_str();
-    }
-    argv[args.size()] = nullptr;
+    const builtin* b = find_builtin(this);
 
-    // Check if command is `cd` for later
-    bool is_cd = !this->sub_front && strcmp(argv[0], "cd") == 0;
-    if (is_cd) {
-        // If no argument to `cd`, remain in the same directory
-        if (!argv[1]) {
-            argv[1] = ".";
-        }
-    }
-    
-    // Set up pipeline if necessary
+    // Set up pipeline if necessary. Pipe ends are close-on-exec; only
+    // the copies installed as stdin/stdout survive into the command.
     int pfd[2];
-    if (this->link == TYPE_PIPE && pipe(pfd) == -1) {
+    if (this->link == TYPE_PIPE && pipe2(pfd, O_CLOEXEC) == -1) {
         fprintf(stderr, "%s\n", strerror(errno));
         return -1;
     }
-
-    pid_t child_pid = fork();
-    if (child_pid == -1) {
+    // Pipe dance (only pipe if input/output is not being redirected)
+    bool pipe_in = this->readfd != -1 && !this->redirects(STDIN_FILENO);
+    bool pipe_out = this->link == TYPE_PIPE
+        && !this->redirects(STDOUT_FILENO);
+
+    std::vector<std::pair<int, int>> fds;
+    pid_t child_pid = -1;
+    if (!open_redirections(fds)) {
+        // Error already reported; the command fails without running
+    } else if (!this->sub_front && !b && !this->subst) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (pipe_in) {
+            posix_spawn_file_actions_adddup2(&actions, this->readfd,
+                                             STDIN_FILENO);
+        }
+        if (pipe_out) {
+            posix_spawn_file_actions_adddup2(&actions, pfd[1], STDOUT_FILENO);
+        }
+        for (auto& fp : fds) {
+            posix_spawn_file_actions_adddup2(&actions, fp.first, fp.second);
+        }
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, pgid);
+
+        int r = spawn_command(&child_pid, this->argv, &actions, &attr);
+        if (r != 0) {
+            fprintf(stderr, "%s: %s\n", this->argv[0], strerror(r));
+            child_pid = -1;
+        }
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+    } else if ((child_pid = fork()) == -1) {
         fprintf(stderr, "%s\n", strerror(errno));
-        return -1;
     } else if (child_pid == 0) {
         // Child process
         // Set process group ID
         setpgid(0, pgid);
+        set_signal_handler(SIGCHLD, SIG_DFL);
 
-        // Set up input redirection
-        for (auto file : this->in_files) {
-            int fd = open(file.second.c_str(), O_RDONLY);
-            if (fd == -1) {
-                perror(file.second.c_str());
-                _exit(EXIT_FAILURE);
-            }
-            dup2(fd, file.first);
-            close(fd);
+        // Install pipe ends and redirections
+        if (pipe_in) {
+            dup2(this->readfd, STDIN_FILENO);
         }
-        // Set up output redirection
-        for (auto file : this->out_files) {
-            int fd = open(file.second.first.c_str(),
-                O_WRONLY | O_CREAT | file.second.second, 0666);
-            if (fd == -1) {
-                perror(file.second.first.c_str());
-                _exit(EXIT_FAILURE);
-            }
-            dup2(fd, file.first);
-            close(fd);
+        if (pipe_out) {
+            dup2(pfd[1], STDOUT_FILENO);
         }
-        
-        // Pipe dance (only pipe if input/output is not being redirected)
-        if (this->readfd != -1 && this->in_files.find(STDIN_FILENO) == this->in_files.end()) {
-            // Reader
-            dup2(this->readfd, STDIN_FILENO);
+        for (auto& fp : fds) {
+            dup2(fp.first, fp.second);
+            close(fp.first);
+        }
+        if (this->readfd != -1) {
             close(this->readfd);
         }
-        if (this->link == TYPE_PIPE && this->out_files.find(STDOUT_FILENO) == this->out_files.end()) {
-            // Writer
+        if (this->link == TYPE_PIPE) {
             close(pfd[0]);
-            dup2(pfd[1], STDOUT_FILENO);
             close(pfd[1]);
         }
 
         // Execute process
         if (this->sub_front) {
-            // Run subshell
-            if(run(this->sub_front) == 0) {
-                _exit(EXIT_SUCCESS);
-            } else {
-                _exit(EXIT_FAILURE);
-            }
-        } else if (is_cd) {
-            // If `cd`, repeat in child to report success/failure
-            if (args.size() > 2) {
-                fprintf(stderr, "cd: too many arguments\n");
-                _exit(EXIT_FAILURE);
-            }
-            if (chdir(argv[1]) == -1) {
-                perror(argv[1]);
-                _exit(EXIT_FAILURE);
-            }
+            // Run subshell; its commands join its process group, and
+            // its last command replaces it
+            job_pgid = getpgrp();
+            exec_last = true;
+            _exit(run(this->sub_front));
+        }
+        // Expand command substitutions here, so that they run in
+        // parallel with the rest of the pipeline
+        arena expansion;
+        if (this->subst) {
+            this->expand(expansion);
+            b = find_builtin(this);
+        }
+        if (b) {
+            // Run builtin
+            this->status = b->fn(this);
+            fflush(stdout);
+            _exit(this->status);
+        } else if (this->argc == 0) {
+            _exit(EXIT_SUCCESS);
+        } else {
+            exec_command(this->argv);
+        }
+    } else {
+        // Set process group ID for child to avoid race condition
+        setpgid(child_pid, pgid);
+    }
+
+    // Parent process
+    this->pid = child_pid;
+    for (auto& fp : fds) {
+        close(fp.first);
+    }
+    // Pipe dance (parent of writer)
+    if (this->link == TYPE_PIPE) {
+        close(pfd[1]);
+        this->next->readfd = pfd[0];
+    }
+    // Pipe dance (parent of reader); the command can run again later
+    if (this->readfd != -1) {
+        close(this->readfd);
+        this->readfd = -1;
+    }
+    return child_pid;
+}
+
+
+// command::run_in_shell(b)
+//    Run the builtin `b` for this command inside the shell, without
+//    forking, and set `this->status` to its exit status. Redirections
+//    apply only while the builtin runs: each redirected fd is saved
+//    first and restored afterwards.
+
+void command::run_in_shell(const builtin* b) {
+    // Substitutions are expanded for this run only; the raw words are
+    // restored afterwards
+    const char** raw_argv = this->argv;
+    unsigned raw_argc = this->argc, raw_argcap = this->argcap;
+    arena expansion;
+    if (this->subst) {
+        this->expand(expansion);
+    }
+
+    std::vector<std::pair<int, int>> fds;
+    if (!open_redirections(fds)) {
+        this->status = EXIT_FAILURE;
+    } else {
+        run_in_shell_with(b, fds);
+    }
+    this->argv = raw_argv;
+    this->argc = raw_argc;
+    this->argcap = raw_argcap;
+}
+
+
+// command::run_in_shell_with(b, fds)
+//    Helper for `run_in_shell`: install the opened redirections `fds`,
+//    run builtin `b`, then restore the shell's fds.
+
+void command::run_in_shell_with(const builtin* b,
+                                std::vector<std::pair<int, int>>& fds) {
+    // Save each target (-1 if it was closed), then install its file
+    std::vector<std::pair<int, int>> saved;
+    for (auto& fp : fds) {
+        saved.push_back({fcntl(fp.second, F_DUPFD_CLOEXEC, 10), fp.second});
+        dup2(fp.first, fp.second);
+        close(fp.first);
+    }
+
+    this->status = b->fn(this);
+
+    // Restore in reverse order, in case a target was redirected twice
+    for (auto it = saved.rbegin(); it != saved.rend(); ++it) {
+        if (it->first >= 0) {
+            dup2(it->first, it->second);
+            close(it->first);
+        } else {
+            close(it->second);
+        }
+    }
+}
+
+
+// command::exec_in_place()
+//    Run this command in the current process, which must be a subshell
+//    or a job's child shell about to exit once the command finishes
+//    (`exec_last`). Saves a fork and a wait. Redirections are installed
+//    directly, and any command but a subshell replaces the shell with
+//    `execv`. A subshell's list runs here, without another child: this
+//    sets `exec_subshell` and returns, and the caller unwinds to `run`,
+//    which continues with that list. Nested subshells therefore run in
+//    constant stack space. Other commands do not return.
+
+void command::exec_in_place() {
+    std::vector<std::pair<int, int>> fds;
+    if (!open_redirections(fds)) {
+        _exit(EXIT_FAILURE);
+    }
+    for (auto& fp : fds) {
+        dup2(fp.first, fp.second);
+        close(fp.first);
+    }
+    if (this->sub_front) {
+        exec_subshell = this->sub_front;
+        return;
+    }
+    arena expansion;
+    if (this->subst) {
+        this->expand(expansion);
+        if (this->argc == 0) {
             _exit(EXIT_SUCCESS);
-        } else if (execvp(argv[0], (char**) argv) == -1) {
-            _exit(EXIT_FAILURE);
+        } else if (const builtin* b = find_builtin(this)) {
+            this->status = b->fn(this);
+            fflush(stdout);
+            _exit(this->status);
         }
-    } else {
-        // Parent process
-        this->pid = child_pid;
+    }
+    exec_command(this->argv);
+}
 
-        // Set process group ID for child to avoid race condition
-        setpgid(child_pid, pgid);
 
-        // Pipe dance (parent of writer)
-        if (this->link == TYPE_PIPE) {
-            close(pfd[1]);
-            this->next->readfd = pfd[0];
-        }
+// run_pipeline(c, pgid)
+//    Run the pipeline of commands starting with `c`, all with the
+//    process group ID `pgid` (0 means the first command's process ID);
+//    returns this pgid.
 
-        // Pipe dance (parent of reader)
-        if (this->readfd != -1) {
-            close(this->readfd);
+pid_t run_pipeline(command *c, pid_t pgid) {
+    while (true) {
+        pid_t pid = c->make_child(pgid);
+        if (pgid == 0 && pid > 0) {
+            pgid = pid;
         }
-
-        // Handle `cd` as a special case
-        if (is_cd) {
-            int r = chdir(argv[1]);
-            // No need to check return value as this is done in the child
-            (void) r;
+        if (c->link != TYPE_PIPE) {
+            break;
         }
+        c = c->next;
     }
-
-    return child_pid;
+    return pgid;
 }
 
 
-// run_pipeline(command *c)
-//    Run the pipeline of commands starting with `c`, all with
-//    the same process group ID; returns this pgid.
+// report_time(front, last, start)
+//    Print the resource usage of the timed pipeline from `front` through
+//    `last`, which started at time `start`, on standard error. User and
+//    system time and context switches are summed over the stages (each
+//    stage's figures include the children it waited for); `maxrss` is
+//    the largest of any stage.
 
-pid_t run_pipeline(command *c) {
-    pid_t pgid = c->make_child(0);
-    for (; c->next; c = c->next) {
-        if (c->link != TYPE_PIPE) {
+void report_time(command* front, command* last, const timespec& start) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_nsec < start.tv_nsec) {
+        now.tv_nsec += 1000000000;
+        --now.tv_sec;
+    }
+    struct rusage total;
+    memset(&total, 0, sizeof(total));
+    for (command* c = front; ; c = c->next) {
+        timeradd(&total.ru_utime, &c->usage.ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &c->usage.ru_stime, &total.ru_stime);
+        total.ru_maxrss = std::max(total.ru_maxrss, c->usage.ru_maxrss);
+        total.ru_nvcsw += c->usage.ru_nvcsw;
+        total.ru_nivcsw += c->usage.ru_nivcsw;
+        if (c == last) {
             break;
         }
-        c->next->make_child(pgid);
     }
-    return pgid;
+    long sec = now.tv_sec - start.tv_sec;
+    long usec = (now.tv_nsec - start.tv_nsec) / 1000;
+    if (front->time == TIME_JSON) {
+        fprintf(stderr, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, "
+                "\"stime\":%ld.%06ld, \"maxrss\":%ld, \"nvcsw\":%ld, "
+                "\"nivcsw\":%ld}\n", sec, usec,
+                total.ru_utime.tv_sec, (long) total.ru_utime.tv_usec,
+                total.ru_stime.tv_sec, (long) total.ru_stime.tv_usec,
+                total.ru_maxrss, total.ru_nvcsw, total.ru_nivcsw);
+    } else {
+        fprintf(stderr, "real %ld.%03lds  user %ld.%03lds  sys %ld.%03lds  "
+                "maxrss %ldk  csw %ld+%ld\n", sec, usec / 1000,
+                total.ru_utime.tv_sec, (long) total.ru_utime.tv_usec / 1000,
+                total.ru_stime.tv_sec, (long) total.ru_stime.tv_usec / 1000,
+                total.ru_maxrss, total.ru_nvcsw, total.ru_nivcsw);
+    }
 }
 
 
@@ -236,9 +1460,10 @@ pid_t run_pipeline(command *c) {
 //    `c` is in, or -1 if none.
 
 int get_cond_type(command* c) {
-    if (c->link == TYPE_PIPE) {
-        return get_cond_type(c->next);
-    } else if (c->link == TYPE_AND || c->link == TYPE_OR) {
+    while (c->link == TYPE_PIPE) {
+        c = c->next;
+    }
+    if (c->link == TYPE_AND || c->link == TYPE_OR) {
         return c->link;
     } else {
         return -1;
@@ -246,10 +1471,80 @@ int get_cond_type(command* c) {
 }
 
 
+// wait_pipeline(front, last, pgid, fg)
+//    Wait for every stage of the pipeline from `front` through `last`,
+//    recording each stage's exit status and resource usage in its
+//    `status` and `usage`, and claim the foreground for process group
+//    `pgid` meanwhile if `fg` is true. Returns the pipeline's wait
+//    status: that of `last`, or with `set -o pipefail`, that of the
+//    last stage that failed. (A command that the shell ran itself, or
+//    could not start, already has its status in `status`.) In the
+//    top-level shell, a stopped pipeline becomes a job, and its
+//    remaining stages are left to `reap_jobs`.
+
+int wait_pipeline(command* front, command* last, pid_t pgid, bool fg) {
+    int options = fg && getpid() == shell_pid ? WUNTRACED : 0;
+    int result = W_EXITCODE(EXIT_FAILURE, 0);
+    bool failed = false;
+    fg && pgid > 0 && claim_foreground(pgid);
+    for (command* c = front; ; c = c->next) {
+        int wstatus = W_EXITCODE(c->status, 0);
+        if (c->pid != -1) {
+            while (wait4(c->pid, &wstatus, options, &c->usage) == -1
+                   && errno == EINTR) {
+            }
+            if (WIFSTOPPED(wstatus)) {
+                job& j = add_job(pgid, last->pid, JOB_STOPPED,
+                                 command_text(front, last));
+                j.wstatus = wstatus;
+                report_jobs && printf("\n");
+                result = wstatus;
+                break;
+            }
+            c->status = exit_status_of(wstatus);
+        }
+        if (opt_pipefail && c->status != 0) {
+            result = wstatus;
+            failed = true;
+        } else if (c == last && !failed) {
+            result = wstatus;
+        }
+        if (c == last) {
+            break;
+        }
+    }
+    fg && pgid > 0 && claim_foreground(0);
+    return result;
+}
+
+
+// report_pipeline(front, last, start)
+//    Print the status and resource usage of each stage of the pipeline
+//    from `front` through `last`, which started at time `start`, on
+//    standard error (`set -o pipestats`).
+
+void report_pipeline(command* front, command* last, const timespec& start) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "sh61: %.3fs real\n", (now.tv_sec - start.tv_sec)
+            + (now.tv_nsec - start.tv_nsec) / 1e9);
+    for (command* c = front; ; c = c->next) {
+        const struct rusage& ru = c->usage;
+        fprintf(stderr, "sh61:   %.3fu %.3fs %7ldk  status %-3d  %s\n",
+                ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+                ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+                ru.ru_maxrss, c->status, command_text(c, c).c_str());
+        if (c == last) {
+            break;
+        }
+    }
+}
+
+
 // run_conditional(c, bg)
 //    Run the conditional chain of pipelines starting with `c`
-//    in the background (if `bg` is true) or foreground (otherwise).
-//    Returns the exit status.
+//    in the background (if `bg` is true, in a job's child shell) or
+//    foreground (otherwise). Returns the exit status.
 
 int run_conditional(command *c, bool bg) {
     // Mark all subshell commands to avoid claiming foreground
@@ -259,72 +1554,135 @@ int run_conditional(command *c, bool bg) {
         }
     }
     int exit_status = -1;
-    pid_t pid = -1;
-    if (bg) {
-        // Create new shell for background process
-        pid = fork();
-        if (pid == -1) {
-            fprintf(stderr, "%s\n", strerror(errno));
-            return exit_status;
-        } else if (pid == 0) {
-            // Ignore SIGINT in the child shell
-            set_signal_handler(SIGINT, SIG_IGN);
-        }
-    }
-
-    if (!bg || pid == 0) {
-        while (true) {
-            // Run pipeline
-            pid_t pgid = run_pipeline(c);
-            // Seek to end of pipeline 
-            while (c->link == TYPE_PIPE) {
-                c = c->next;
-            }
+    while (true) {
+        // Run pipeline; a lone builtin runs in this shell
+        command* pfront = c;
+        pid_t pgid = -1;
+        timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        // (In a subshell or job shell, the last command replaces the
+        // shell unless it must be waited for here)
+        const builtin* b = find_builtin(c);
+        if (b && c->link != TYPE_PIPE) {
+            c->run_in_shell(b);
+        } else if (exec_last && c->link != TYPE_PIPE
+                   && (!c->next || c->link == TYPE_BACKGROUND)
+                   && c->time == TIME_NONE && !opt_pipestats) {
+            c->exec_in_place();
+            // A subshell's list continues in `run`
+            return EXIT_SUCCESS;
+        } else {
+            // In a job's child shell, or a shell without the terminal,
+            // pipelines join `job_pgid`
+            pgid = run_pipeline(c, job_pgid);
+        }
+        // Seek to end of pipeline 
+        while (c->link == TYPE_PIPE) {
+            c = c->next;
+        }
 
-            // Wait for last command in pipeline to terminate
-            // and claim foreground if necessary (for interruptions)
-            !bg && !c->sub_bg && claim_foreground(pgid);
-            int wstatus;
-            pid_t exited_pid = waitpid(c->pid, &wstatus, 0);
-            assert(c->pid == exited_pid);
-            !bg && !c->sub_bg && claim_foreground(0);
-
-            // Handle conditionals by skipping each command whose
-            // exit status is irrelevant to the conditional
-            if (WIFEXITED(wstatus)) {
-                // Process exited (either success or failure)
-                exit_status = WEXITSTATUS(wstatus);
-                while ((exit_status == 0 && get_cond_type(c) == TYPE_OR)
-                       || (exit_status != 0 && get_cond_type(c) == TYPE_AND)) {
-                    do {
-                        c = c->next;
-                    } while (c->link == TYPE_PIPE);
-                }
-            } else if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGINT) {
-                // Process was terminated by SIGINT (always failure)
-                exit_status = 1;
-                while (get_cond_type(c) == TYPE_AND) {
-                    do {
-                        c = c->next;
-                    } while (c->link == TYPE_PIPE);
-                }
-                printf("\n");
-            }
+        // Wait for every command in pipeline to terminate
+        // and claim foreground if necessary (for interruptions)
+        int wstatus = wait_pipeline(pfront, c, pgid, !bg && !c->sub_bg);
+        if (opt_pipestats && pgid != -1) {
+            report_pipeline(pfront, c, start);
+        }
+        if (pfront->time != TIME_NONE) {
+            report_time(pfront, c, start);
+        }
 
-            // If next is within this conditional, run it in same shell
-            if (c->link != TYPE_BACKGROUND && c->link != TYPE_SEQUENCE) {
+        // Handle conditionals by skipping each command whose
+        // exit status is irrelevant to the conditional
+        // (A process terminated by SIGINT always fails.)
+        exit_status = exit_status_of(wstatus);
+        if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGINT) {
+            printf("\n");
+        }
+        while ((exit_status == 0 && get_cond_type(c) == TYPE_OR)
+               || (exit_status != 0 && get_cond_type(c) == TYPE_AND)) {
+            do {
                 c = c->next;
-            } else {
+            } while (c->link == TYPE_PIPE);
+        }
+
+        // If next is within this conditional, run it in same shell
+        if (c->link != TYPE_BACKGROUND && c->link != TYPE_SEQUENCE) {
+            c = c->next;
+        } else {
+            break;
+        }
+    }
+    return exit_status;
+}
+
+
+// start_job(c, last)
+//    Start the conditional chain from `c` through `last` as a background
+//    job leading a new process group, and record it in the job table.
+//    Returns the exit status.
+//
+//    A lone pipeline is started directly, and the job's process is its
+//    last command. Otherwise a child shell runs the chain, and its last
+//    command replaces that shell (see `exec_in_place`).
+
+int start_job(command* c, command* last) {
+    bool lone_pipeline = c->time == TIME_NONE && !opt_pipestats
+        && !opt_pipefail;
+    for (command* it = c; it != last && lone_pipeline; it = it->next) {
+        lone_pipeline = it->link == TYPE_PIPE;
+    }
+    if (lone_pipeline) {
+        // Keep subshells from claiming the foreground
+        for (command* it = c; ; it = it->next) {
+            for (command* sub = it->sub_front; sub; sub = sub->next) {
+                sub->sub_bg = true;
+            }
+            if (it == last) {
                 break;
             }
         }
-        
-        if (pid == 0) {
-            // If this is a child shell, terminate
-            _exit(EXIT_SUCCESS);
+        pid_t pgid = run_pipeline(c, 0);
+        if (last->pid == -1) {
+            // Error already reported; earlier stages are reaped later
+            return EXIT_FAILURE;
+        }
+        job& j = add_job(pgid, last->pid, JOB_RUNNING, command_text(c, last));
+        j.reported = true;
+        if (report_jobs) {
+            printf("[%d] %d\n", j.id, last->pid);
+            fflush(stdout);
         }
+        return EXIT_SUCCESS;
     }
-    return exit_status;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        fprintf(stderr, "%s\n", strerror(errno));
+        return EXIT_FAILURE;
+    } else if (pid == 0) {
+        // Child shell: its pipelines join its process group
+        setpgid(0, 0);
+        job_pgid = getpid();
+        set_signal_handler(SIGCHLD, SIG_DFL);
+        jobs.clear();
+        job_pids.clear();
+        exec_last = true;
+        int exit_status = run_conditional(c, true);
+        if (command* sub = exec_subshell) {
+            exec_subshell = nullptr;
+            exit_status = run(sub);
+        }
+        _exit(exit_status);
+    }
+    // Set process group ID for child to avoid race condition
+    setpgid(pid, pid);
+    job& j = add_job(pid, pid, JOB_RUNNING, command_text(c, last));
+    j.reported = true;
+    if (report_jobs) {
+        printf("[%d] %d\n", j.id, pid);
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
 }
 
 
@@ -349,107 +1707,557 @@ int run_conditional(command *c, bool bg) {
 //       - Call `claim_foreground(0)` once the pipeline is complete.
 
 int run(command* c) {
-    command* front = c;
-    // Seek to end of conditional
-    while (c->link != TYPE_SEQUENCE && c->link != TYPE_BACKGROUND) {
+    // Run each `;`- or `&`-terminated conditional in turn. This loops
+    // rather than recursing, so a line of any length runs in constant
+    // stack space. A subshell run in place (see `exec_in_place`) was the
+    // last command, so its list replaces the rest of this one.
+    int exit_status = 0;
+    while (c) {
+        command* front = c;
+        // Seek to end of conditional
+        while (c->link != TYPE_SEQUENCE && c->link != TYPE_BACKGROUND) {
+            c = c->next;
+        }
+        if (c->link == TYPE_BACKGROUND) {
+            exit_status = start_job(front, c);
+        } else {
+            exit_status = run_conditional(front, false);
+        }
+        if (exec_subshell) {
+            c = exec_subshell;
+            exec_subshell = nullptr;
+            continue;
+        }
         c = c->next;
     }
-    int exit_status = run_conditional(front, c->link == TYPE_BACKGROUND);
-    if (c->next) {
-        exit_status = run(c->next);
-    }
     return exit_status;
 }
 
 
-// parse_list(it, end)
+// token_copy(it, a)
+//    Return the contents of token `it`, unquoted and copied into arena
+//    `a`. Nothing else is allocated.
+
+static const char* token_copy(const shell_token_iterator& it, arena& a) {
+    char* buf = static_cast<char*>(a.allocate(it.view().size() + 1, 1));
+    it.unquote(buf);
+    return buf;
+}
+
+
+// parse_words(it, c, a)
+//    Parse the arguments and redirections of command `c`, starting at
+//    `it`, into arena `a`. Stops at the first control operator.
+
+static void parse_words(shell_token_iterator& it, command* c, arena& a) {
+    // A command with a substitution keeps its arguments raw; they are
+    // expanded each time it runs
+    for (shell_token_iterator scan = it;
+         !c->subst && (scan.type() == TYPE_NORMAL
+                       || scan.type() == TYPE_REDIRECT_OP);
+         ++scan) {
+        c->subst = scan.type() == TYPE_NORMAL && scan.substitutes();
+    }
+
+    redirection** redir_tail = &c->redirs;
+    while (it.type() == TYPE_NORMAL || it.type() == TYPE_REDIRECT_OP) {
+        // Store arguments
+        if (it.type() == TYPE_NORMAL && c->subst) {
+            std::string_view raw = it.view();
+            char* buf = static_cast<char*>(a.allocate(raw.size() + 1, 1));
+            memcpy(buf, raw.data(), raw.size());
+            buf[raw.size()] = '\0';
+            c->add_arg(buf, a);
+        } else if (it.type() == TYPE_NORMAL) {
+            c->add_arg(token_copy(it, a), a);
+        }
+        // Parse redirects
+        if (it.type() == TYPE_REDIRECT_OP) {
+            std::string_view op = it.view();
+            ++it;
+            assert(it.type() == TYPE_NORMAL);
+
+            // Get fd (if present) and raw operator (without fd)
+            int fd = -1;
+            size_t pos = 0;
+            for (; pos < op.size() && isdigit((unsigned char) op[pos]);
+                 ++pos) {
+                fd = (fd == -1 ? 0 : fd * 10) + (op[pos] - '0');
+            }
+            size_t oplen = 0;
+            while (pos + oplen < op.size()
+                   && (op[pos + oplen] == '<' || op[pos + oplen] == '>'
+                       || op[pos + oplen] == '-')) {
+                ++oplen;
+            }
+            std::string_view op_raw = op.substr(pos, oplen);
+
+            int flags = -1;
+            here_type here = HERE_NONE;
+            if (op_raw == "<<" || op_raw == "<<-" || op_raw == "<<<") {
+                fd = fd == -1 ? STDIN_FILENO : fd;
+                flags = O_RDONLY;
+                here = op_raw == "<<" ? HERE_DOC
+                    : (op_raw == "<<-" ? HERE_DOC_STRIP : HERE_STRING);
+            } else if (op_raw == "<") {
+                fd = fd == -1 ? STDIN_FILENO : fd;
+                flags = O_RDONLY;
+            } else if (op_raw == ">" || op_raw == ">>") {
+                fd = fd == -1 ? STDOUT_FILENO : fd;
+                flags = O_WRONLY | O_CREAT
+                    | (op_raw == ">>" ? O_APPEND : O_TRUNC);
+            }
+            if (flags != -1) {
+                redirection* r = a.make<redirection>();
+                *r = {fd, flags, token_copy(it, a), nullptr, here,
+                      nullptr, 0};
+                if (here == HERE_STRING) {
+                    // The body is the word plus a newline
+                    size_t n = strlen(r->file);
+                    char* body = static_cast<char*>(a.allocate(n + 1, 1));
+                    memcpy(body, r->file, n);
+                    body[n] = '\n';
+                    r->body = body;
+                    r->bodylen = n + 1;
+                }
+                *redir_tail = r;
+                redir_tail = &r->next;
+            }
+        }
+        ++it;
+    }
+}
+
+
+// parse_time(it, c)
+//    If `it` is the `time` keyword (unquoted, at the start of pipeline
+//    `c`, and followed by a command), mark `c` as timed and skip the
+//    keyword and its `-j` option.
+
+static void parse_time(shell_token_iterator& it, command* c) {
+    auto is_word = [] (const shell_token_iterator& t, const char* word) {
+        return t.type() == TYPE_NORMAL && !t.quoted() && t.view() == word;
+    };
+    if (!is_word(it, "time")) {
+        return;
+    }
+    shell_token_iterator next = it;
+    ++next;
+    time_format format = TIME_TEXT;
+    if (is_word(next, "-j")) {
+        format = TIME_JSON;
+        ++next;
+    }
+    if (next.type() == TYPE_NORMAL || next.type() == TYPE_LPAREN) {
+        c->time = format;
+        it = next;
+    }
+}
+
+
+// parse_list(it, end, a)
 //    Parse the command list starting at `it` and ending with
-//    a right parenthesis or until `end` is encountered.
+//    a right parenthesis or until `end` is encountered. The commands
+//    are allocated in arena `a`.
+//
+//    Subshells are parsed with an explicit stack of the enclosing lists,
+//    not by recursion, so deeply nested parentheses cannot overflow the
+//    C++ stack.
 
-command* parse_list(shell_token_iterator& it, shell_token_iterator end) {
+command* parse_list(shell_token_iterator& it, shell_token_iterator end,
+                    arena& a) {
     // Build the command
     command* front = nullptr;
     command* c = nullptr;
+    std::vector<std::pair<command*, command*>> outer;  // (front, subshell)
     for (; it != end; ++it) {
         // Create command in linked list
+        bool starts_pipeline = !c || c->link != TYPE_PIPE;
         if (!front) {
-            front = new command;
+            front = a.make<command>();
             c = front;
         } else {
-            c->next = new command;
+            c->next = a.make<command>();
             c = c->next;
         }
+        if (starts_pipeline) {
+            parse_time(it, c);
+        }
 
-        // Parse subshell list
-        if (it.type() == TYPE_LPAREN) {
+        // Start subshell lists
+        while (it.type() == TYPE_LPAREN) {
+            outer.push_back({front, c});
             ++it;
-            c->sub_front = parse_list(it, end);
+            front = a.make<command>();
+            c = front;
+            parse_time(it, c);
+        }
+
+        parse_words(it, c, a);
+        c->link = it.type();
+
+        // Finish subshell lists; the subshell command itself may have
+        // redirections
+        while (c->link == TYPE_RPAREN) {
+            c->link = TYPE_SEQUENCE;
+            if (outer.empty()) {
+                return front;
+            }
+            command* sub_front = front;
+            std::tie(front, c) = outer.back();
+            outer.pop_back();
+            c->sub_front = sub_front;
             ++it;
+            parse_words(it, c, a);
+            c->link = it.type();
         }
-        
-        while (it.type() == TYPE_NORMAL || it.type() == TYPE_REDIRECT_OP) {
-            // Store arguments
-            if (it.type() == TYPE_NORMAL) {
-                c->args.push_back(it.str());
+    }
+    // Close any subshells left open at the end of the line
+    while (!outer.empty()) {
+        command* sub_front = front;
+        std::tie(front, c) = outer.back();
+        outer.pop_back();
+        c->sub_front = sub_front;
+    }
+    return front;
+}
+
+
+// line_source
+//    A function that sets its argument to the next input line (without
+//    its newline) and returns true, or returns false at end of input.
+//    Here-document bodies are read from the lines after the command.
+
+using line_source = std::function<bool(std::string&)>;
+
+
+// read_here_document(r, a, next_line)
+//    Read the body of here-document `r` from `next_line` into arena `a`.
+//    The body ends at a line equal to its delimiter, or at end of input
+//    (with a warning).
+
+static void read_here_document(redirection* r, arena& a,
+                               const line_source& next_line) {
+    std::string body, line;
+    bool found = false;
+    while (next_line(line)) {
+        size_t skip = 0;
+        while (r->here == HERE_DOC_STRIP && skip < line.size()
+               && line[skip] == '\t') {
+            ++skip;
+        }
+        if (line.compare(skip, std::string::npos, r->file) == 0) {
+            found = true;
+            break;
+        }
+        body.append(line, skip);
+        body += '\n';
+    }
+    if (!found) {
+        fprintf(stderr, "sh61: warning: here-document delimited "
+                "by end-of-file (wanted `%s')\n", r->file);
+    }
+    char* buf = static_cast<char*>(a.allocate(body.size() + 1, 1));
+    memcpy(buf, body.data(), body.size());
+    r->body = buf;
+    r->bodylen = body.size();
+}
+
+
+// read_here_documents(c, a, next_line)
+//    Read the bodies of the here-documents in the command list `c`, in
+//    command-line order, from `next_line` into arena `a`. (A subshell's
+//    own redirections follow those of its list.) Walks the subshell tree
+//    with an explicit stack.
+
+void read_here_documents(command* c, arena& a, const line_source& next_line) {
+    std::vector<command*> subshells;    // subshells whose lists are open
+    while (c || !subshells.empty()) {
+        if (c && c->sub_front) {
+            subshells.push_back(c);
+            c = c->sub_front;
+            continue;
+        } else if (!c) {
+            c = subshells.back();
+            subshells.pop_back();
+        }
+        for (redirection* r = c->redirs; r; r = r->next) {
+            if ((r->here == HERE_DOC || r->here == HERE_DOC_STRIP)
+                && !r->body) {
+                read_here_document(r, a, next_line);
             }
-            // Parse redirects
-            if (it.type() == TYPE_REDIRECT_OP) {
-                std::string op = it.str();
-                ++it;
-                assert(it.type() == TYPE_NORMAL);
-
-                // Get fd (if present) and raw operator (without fd)
-                int fd = -1;
-                std::string op_raw;
-                if (isdigit(op.at(0))) {
-                    fd = std::stoi(op);
-                    for (unsigned i = 0; i < op.length(); ++i) {
-                        if (!isdigit(op.at(i))) {
-                            op_raw += op.at(i);
-                        }
-                    }
-                } else {
-                    op_raw = op;
-                }
+        }
+        c = c->next;
+    }
+}
+
+
+// parse_line(s, a, next_line)
+//    Parse the command list in `s` into arena `a` and return it, reading
+//    any here-document bodies from `next_line`. Returns `nullptr` if `s`
+//    is empty (only spaces).
+
+command* parse_line(const char* s, arena& a, const line_source& next_line) {
+    shell_parser parser(s);
+    shell_token_iterator it = parser.begin();
+    command* c = parse_list(it, parser.end(), a);
+    read_here_documents(c, a, next_line);
+    return c;
+}
+
+
+// parse_script(fd, a, script)
+//    Read the whole command file `fd` and parse each of its lines into
+//    arena `a`, appending the resulting command lists (`nullptr` for
+//    empty lines) to `script`. Lines consumed as here-document bodies
+//    are not commands. The file is parsed only once, however often its
+//    commands run. Returns false on read error.
+
+bool parse_script(int fd, arena& a, std::vector<command*>& script) {
+    std::string text;
+    char buf[BUFSIZ];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            text.append(buf, n);
+        } else if (n == 0) {
+            break;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    size_t pos = 0;
+    auto next_line = [&] (std::string& line) {
+        if (pos >= text.size()) {
+            return false;
+        }
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) {
+            eol = text.size();
+        }
+        line.assign(text, pos, eol - pos);
+        pos = eol + 1;
+        return true;
+    };
+    while (pos < text.size()) {
+        size_t eol = text.find('\n', pos);
+        if (eol == std::string::npos) {
+            eol = text.size();
+        }
+        text[eol] = '\0';          // (`text[text.size()]` is the null)
+        const char* s = &text[pos];
+        pos = eol + 1;
+        script.push_back(parse_line(s, a, next_line));
+    }
+    return true;
+}
+
+
+// COMMAND SUBSTITUTION
+
+// capture_output(text, out)
+//    Run the command list `text` (the inside of a `$(...)`) in a child
+//    shell and append its standard output to `out`. The output comes
+//    through a pipe. It is read into a stack buffer first, so a small
+//    output, the common case, takes one read (plus the one that sees end
+//    of file) and one append; larger outputs are read straight into
+//    `out`, growing it, up to `max_substitution` bytes.
 
-                if (op_raw == "<") {
-                    fd = fd == -1 ? STDIN_FILENO : fd;
-                    c->in_files[fd] = it.str();
-                } else if (op_raw == ">" || op_raw == ">>") {
-                    fd = fd == -1 ? STDOUT_FILENO : fd;
-                    int mode = O_TRUNC;
-                    if (op_raw == ">>") {
-                        mode = O_APPEND;
+static constexpr size_t max_substitution = size_t(1) << 26;
+
+static void capture_output(const std::string& text, std::string& out) {
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) == -1) {
+        perror("sh61");
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("sh61");
+        close(pfd[0]);
+        close(pfd[1]);
+        return;
+    } else if (pid == 0) {
+        // Child shell: like a subshell, with output into the pipe
+        dup2(pfd[1], STDOUT_FILENO);
+        set_signal_handler(SIGCHLD, SIG_DFL);
+        job_pgid = getpgrp();
+        exec_last = true;
+        jobs.clear();
+        job_pids.clear();
+        arena a;
+        command* c = parse_line(text.c_str(), a,
+                                [] (std::string&) { return false; });
+        _exit(c ? run(c) : EXIT_SUCCESS);
+    }
+    close(pfd[1]);
+
+    char buf[4096];
+    size_t nbuf = 0;
+    ssize_t r = 0;
+    while (nbuf != sizeof(buf)
+           && ((r = read(pfd[0], buf + nbuf, sizeof(buf) - nbuf)) > 0
+               || (r == -1 && errno == EINTR))) {
+        nbuf += std::max(r, ssize_t(0));
+    }
+    out.append(buf, nbuf);
+    size_t start = out.size() - nbuf;
+    while (nbuf == sizeof(buf)) {
+        // Large output: read into `out`, doubling its room as needed
+        size_t len = out.size();
+        if (len - start >= max_substitution) {
+            fprintf(stderr, "sh61: command substitution output truncated "
+                    "at %zu bytes\n", max_substitution);
+            break;
+        }
+        out.resize(std::min(std::max(2 * len, len + sizeof(buf)),
+                            start + max_substitution));
+        r = read(pfd[0], &out[len], out.size() - len);
+        out.resize(len + std::max(r, ssize_t(0)));
+        if (r == 0 || (r == -1 && errno != EINTR)) {
+            break;
+        }
+    }
+    close(pfd[0]);
+    while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR) {
+    }
+}
+
+
+// expand_word(raw, words)
+//    Expand the raw command-line word `raw`, appending the resulting
+//    words to `words`. Quotes and escapes are removed, and each `$(...)`
+//    is replaced by its output without trailing newlines. Output outside
+//    double quotes is split into words at whitespace; inside them, it
+//    stays part of one word. A word that expands to nothing unquoted
+//    disappears.
+
+static void expand_word(const char* raw, std::vector<std::string>& words) {
+    std::string word;
+    bool have_word = false;     // true iff `word` is a word, even if empty
+    int curquote = 0;
+    for (const char* s = raw; *s; ) {
+        if (s[0] == '$' && s[1] == '(' && curquote != '\'') {
+            const char* end = skip_substitution(s + 2);
+            size_t len = end - (s + 2) - (end[-1] == ')' ? 1 : 0);
+            std::string output;
+            capture_output(std::string(s + 2, len), output);
+            while (!output.empty() && output.back() == '\n') {
+                output.pop_back();
+            }
+            if (curquote) {
+                word += output;
+            } else {
+                for (char ch : output) {
+                    if (ch != ' ' && ch != '\t' && ch != '\n') {
+                        word += ch;
+                        have_word = true;
+                    } else if (have_word) {
+                        words.push_back(std::move(word));
+                        word.clear();
+                        have_word = false;
                     }
-                    c->out_files[fd] = std::make_pair(it.str(), mode);
                 }
             }
-            ++it;
+            s = end;
+            continue;
+        }
+        if ((*s == '\"' || *s == '\'') && !curquote) {
+            curquote = *s;
+        } else if (*s == curquote) {
+            curquote = 0;
+        } else if (*s == '\\' && s[1] != '\0' && curquote != '\'') {
+            ++s;
+            word += *s;
+        } else {
+            word += *s;
         }
+        have_word = true;
+        ++s;
+    }
+    if (have_word) {
+        words.push_back(std::move(word));
+    }
+}
 
-        c->link = it.type();
-        if (c->link == TYPE_RPAREN) {
-            c->link = TYPE_SEQUENCE;
-            return front;
+
+// command::expand(a)
+//    Replace this command's raw arguments (`subst` is true) with their
+//    expansions, allocated in arena `a`. The raw words are left alone,
+//    so the caller can restore `argv`, `argc`, and `argcap`.
+
+void command::expand(arena& a) {
+    std::vector<std::string> words;
+    for (unsigned i = 0; i != this->argc; ++i) {
+        expand_word(this->argv[i], words);
+    }
+    const char** newargv = a.make_array<const char*>(words.size() + 1);
+    for (size_t i = 0; i != words.size(); ++i) {
+        char* buf = static_cast<char*>(a.allocate(words[i].size() + 1, 1));
+        memcpy(buf, words[i].c_str(), words[i].size() + 1);
+        newargv[i] = buf;
+    }
+    newargv[words.size()] = nullptr;
+    this->argv = newargv;
+    this->argc = words.size();
+    this->argcap = words.size() + 1;
+}
+
+
+// read_input(input)
+//    Wait until standard input is readable, then append what it has to
+//    `input`. Children that change state meanwhile are collected at
+//    once. Returns false at end of file or on error; returns true,
+//    perhaps having read nothing, if interrupted by a signal.
+
+bool read_input(std::string& input) {
+    struct pollfd pfds[2] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {sigchld_pipe[0], POLLIN, 0}
+    };
+    while (true) {
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                return true;
+            }
+            perror("sh61");
+            return false;
+        }
+        if (pfds[1].revents) {
+            reap_jobs();
+        }
+        if (pfds[0].revents) {
+            break;
         }
     }
-    return front;
+    char buf[BUFSIZ];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n > 0) {
+        input.append(buf, n);
+        return true;
+    } else if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+        return true;
+    }
+    if (n == -1) {
+        perror("sh61");
+    }
+    return false;
 }
 
 
-// parse_line(s)
-//    Parse the command list in `s` and return it. Returns `nullptr` if
-//    `s` is empty (only spaces).
+// print_prompt()
+//    Print the shell's prompt.
 
-command* parse_line(const char* s) {
-    shell_parser parser(s);
-    shell_token_iterator it = parser.begin();
-    return parse_list(it, parser.end());
+void print_prompt() {
+    // Add some color
+    printf("\033[1;32msh61");
+    printf("\033[1;34m[%d]", getpid());
+    printf("\033[0m$ ");
+    fflush(stdout);
 }
 
 
 int main(int argc, char* argv[]) {
-    FILE* command_file = stdin;
     bool quiet = false;
 
     // Check for '-q' option: be quiet (print no prompts)
@@ -458,36 +2266,69 @@ int main(int argc, char* argv[]) {
         --argc, ++argv;
     }
 
-    // Check for filename option: read commands from file
-    if (argc > 1) {
-        command_file = fopen(argv[1], "rb");
-        if (!command_file) {
-            perror(argv[1]);
-            exit(1);
-        }
-    }
-
     // - Put the shell into the foreground
     // - Ignore the SIGTTOU signal, which is sent when the shell is put back
     //   into the foreground
     claim_foreground(0);
     set_signal_handler(SIGTTOU, SIG_IGN);
 
+    // Give each pipeline its own process group only if the shell owns the
+    // terminal. Otherwise, pipelines stay in the shell's process group,
+    // so that signals from the terminal (such as SIGINT) reach them.
+    if (!owns_foreground()) {
+        job_pgid = getpgrp();
+    }
+
     // Handle SIGINT by remprompting
     set_signal_handler(SIGINT, signal_handler);
 
-    char buf[BUFSIZ];
-    int bufpos = 0;
+    // Collect children as soon as they change state: SIGCHLD wakes the
+    // main loop through a self-pipe
+    shell_pid = getpid();
+    report_jobs = !quiet;
+    if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("sh61");
+        exit(1);
+    }
+    set_signal_handler(SIGCHLD, sigchld_handler, SA_RESTART);
+
+    // Check for filename option: parse the whole command file up front,
+    // then run its lines in order
+    if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        arena a;
+        std::vector<command*> script;
+        if (fd < 0 || !parse_script(fd, a, script)) {
+            perror(argv[1]);
+            exit(1);
+        }
+        close(fd);
+        for (command* c : script) {
+            if (!quiet) {
+                print_prompt();
+            }
+            if (recd_signal) {
+                recd_signal = 0;
+                printf("\n");
+            }
+            if (c) {
+                run(c);
+            }
+            reap_jobs();
+        }
+        return 0;
+    }
+
+    std::string input;      // input not yet run
+    bool eof = false;
     bool needprompt = true;
 
-    while (!feof(command_file)) {
-        // Print the prompt at the beginning of the line
+    while (true) {
+        // Report changed jobs and print the prompt at the beginning of
+        // the line
         if (needprompt && !quiet) {
-            // Add some color
-            printf("\033[1;32msh61");
-            printf("\033[1;34m[%d]", getpid());
-            printf("\033[0m$ ");
-            fflush(stdout);
+            notify_jobs();
+            print_prompt();
             needprompt = false;
         }
 
@@ -498,41 +2339,43 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        // Read a string, checking for error or EOF
-        if (fgets(&buf[bufpos], BUFSIZ - bufpos, command_file) == nullptr) {
-            if (ferror(command_file) && errno == EINTR) {
-                // ignore EINTR errors
-                clearerr(command_file);
-                buf[bufpos] = 0;
-            } else {
-                if (ferror(command_file)) {
-                    perror("sh61");
+        // If a complete command line has been provided, run it (the
+        // last line need not end with a newline)
+        size_t eol = input.find('\n');
+        if (eol != std::string::npos || (eof && !input.empty())) {
+            std::string line = input.substr(0, eol);
+            input.erase(0, eol == std::string::npos ? eol : eol + 1);
+            // Here-document bodies come from the following lines, which
+            // may not have been read yet
+            auto next_line = [&] (std::string& body_line) {
+                size_t beol;
+                while ((beol = input.find('\n')) == std::string::npos
+                       && !eof) {
+                    if (!quiet) {
+                        printf("> ");
+                        fflush(stdout);
+                    }
+                    if (!read_input(input)) {
+                        eof = true;
+                    }
                 }
-                break;
-            }
-        }
-
-        // If a complete command line has been provided, run it
-        bufpos = strlen(buf);
-        if (bufpos == BUFSIZ - 1 || (bufpos > 0 && buf[bufpos - 1] == '\n')) {
-            if (command* c = parse_line(buf)) {
+                if (beol == std::string::npos && input.empty()) {
+                    return false;
+                }
+                body_line = input.substr(0, beol);
+                input.erase(0, beol == std::string::npos ? beol : beol + 1);
+                return true;
+            };
+            arena a;
+            if (command* c = parse_line(line.c_str(), a, next_line)) {
                 run(c);
-                delete c;
-            }
-            bufpos = 0;
-            needprompt = 1;
-        }
-
-        // Handle zombie processes and interrupt requests
-        pid_t pid = -1;
-        while (true) {
-            pid = waitpid(-1, NULL, WNOHANG);
-            if (pid == 0 || (pid == -1 && errno == ECHILD)) {
-                break;
-            } else if (pid == -1) {
-                fprintf(stderr, "%s\n", strerror(errno));
-                return -1;
             }
+            needprompt = true;
+            reap_jobs();
+        } else if (eof) {
+            break;
+        } else if (!read_input(input)) {
+            eof = true;
         }
     }
 
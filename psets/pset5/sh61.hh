@@ -3,13 +3,18 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstddef>
 #include <csignal>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string>
+#include <string_view>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 #define TYPE_NORMAL        0   // normal command word
-#define TYPE_REDIRECT_OP   1   // redirection operator (>, <, 2>)
+#define TYPE_REDIRECT_OP   1   // redirection operator (>, <, 2>, <<)
 
 // All other tokens are control operators that terminate the current command.
 #define TYPE_SEQUENCE      2   // `;` sequence operator
@@ -58,10 +63,20 @@ private:
 //        // character contents.
 //    }
 //    ```
+//
+//    `it.str()` allocates. To avoid that, use `it.view()`, which refers
+//    to the token’s raw characters (including any quotes) in the command
+//    line, and `it.unquote(buf)`, which writes the contents to `buf`.
 
 struct shell_token_iterator {
     std::string str() const;    // current token’s character contents
     inline int type() const;    // current token’s type
+    inline std::string_view view() const;   // raw characters
+    inline bool quoted() const; // true iff token has quotes or escapes
+    inline bool substitutes() const;    // true iff token has `$(...)`
+    // Write contents plus a null character to `buf`, which must have room
+    // for `view().size() + 1` characters. Returns the contents’ length.
+    size_t unquote(char* buf) const;
 
     // compare iterators
     inline bool operator==(const shell_token_iterator& x) const;
@@ -73,6 +88,7 @@ private:
     const char* _s;
     unsigned short _type;
     bool _quoted;
+    bool _subst;
     unsigned _len;
 
     inline shell_token_iterator(const char* s);
@@ -80,19 +96,97 @@ private:
     friend struct shell_parser;
 };
 
+
+// arena
+//    `arena` objects allocate memory for parsed command lines. Memory
+//    comes from large blocks and is freed all at once when the arena is
+//    destroyed, so building and tearing down a command list costs a few
+//    pointer bumps rather than one `new` and `delete` per node.
+//    Use it as follows:
+//
+//    ```
+//    arena a;
+//    command* c = a.make<command>();   // constructed in `a`
+//    // ... `c` lives until `a` is destroyed
+//    ```
+//
+//    `make` remembers objects with nontrivial destructors and destroys
+//    them (in reverse order of creation) before freeing memory.
+
+struct arena {
+    arena() = default;
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    ~arena();
+
+    void* allocate(size_t sz, size_t align = alignof(std::max_align_t));
+    template <typename T, typename... Args> T* make(Args&&... args);
+    template <typename T> T* make_array(size_t n);
+
+private:
+    struct block {
+        block* prev;
+    };
+    struct destructor {
+        destructor* prev;
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    char* _pos = nullptr;
+    char* _end = nullptr;
+    block* _blocks = nullptr;
+    size_t _blocksize = 4096;
+    destructor* _destructors = nullptr;
+};
+
+template <typename T, typename... Args>
+T* arena::make(Args&&... args) {
+    T* object = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+        destructor* d = new (allocate(sizeof(destructor), alignof(destructor)))
+            destructor{_destructors, [] (void* x) {
+                static_cast<T*>(x)->~T();
+            }, object};
+        _destructors = d;
+    }
+    return object;
+}
+
+template <typename T>
+T* arena::make_array(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena arrays are never destroyed");
+    return new (allocate(n * sizeof(T), alignof(T))) T[n];
+}
+
+
 // claim_foreground(pgid)
 //    Mark `pgid` as the current foreground process group.
 int claim_foreground(pid_t pgid);
 
-// set_signal_handler(signo, handler)
+// skip_substitution(s)
+//    `s` points just after the `$(` of a command substitution. Return a
+//    pointer just past its matching `)`, or to the end of the string if
+//    there is none.
+const char* skip_substitution(const char* s);
+
+// owns_foreground()
+//    Return true iff `claim_foreground` can change the foreground process
+//    group (that is, the shell started in the foreground).
+bool owns_foreground();
+
+// set_signal_handler(signo, handler, flags)
 //    Install handler `handler` for signal `signo`. `handler` can be SIG_DFL
-//    to install the default handler, or SIG_IGN to ignore the signal. Return
+//    to install the default handler, or SIG_IGN to ignore the signal.
+//    `flags`, such as SA_RESTART, are passed on in `sa_flags`. Return
 //    0 on success, -1 on failure. See `man 2 sigaction` or `man 3 signal`.
-inline int set_signal_handler(int signo, void (*handler)(int)) {
+inline int set_signal_handler(int signo, void (*handler)(int), int flags = 0) {
     struct sigaction sa;
     sa.sa_handler = handler;
     sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
+    sa.sa_flags = flags;
     return sigaction(signo, &sa, NULL);
 }
 
@@ -113,6 +207,18 @@ inline int shell_token_iterator::type() const {
     return _type;
 }
 
+inline std::string_view shell_token_iterator::view() const {
+    return std::string_view(_s, _len);
+}
+
+inline bool shell_token_iterator::quoted() const {
+    return _quoted;
+}
+
+inline bool shell_token_iterator::substitutes() const {
+    return _subst;
+}
+
 inline bool shell_token_iterator::operator==(const shell_token_iterator& x) const {
     return _s == x._s;
 }